@@ -0,0 +1,86 @@
+#define _XOPEN_SOURCE 700
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ARENA_BLOCK 65536 // Default block size; bigger requests get a block of their own
+#define ARENA_ALIGN 16
+
+static size_t align_up(size_t n) {
+	return (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+// The header is padded so the first allocation of a block is aligned too
+static char* block_data(struct arena_block* block) {
+	return (char*)block + align_up(sizeof(struct arena_block));
+}
+
+void arena_init(struct arena* a) {
+	a->first = NULL;
+	a->current = NULL;
+}
+
+void* arena_alloc(struct arena* a, size_t size) {
+	size = align_up(size ? size : 1);
+
+	// Move on through blocks kept from earlier commands before asking malloc for more
+	while (a->current != NULL) {
+		struct arena_block* block = a->current;
+
+		if (block->size - block->used >= size) {
+			void* mem = block_data(block) + block->used;
+			block->used += size;
+
+			return mem;
+		}
+
+		if (block->next == NULL) break;
+
+		a->current = block->next;
+		a->current->used = 0;
+	}
+
+	size_t block_size = size > ARENA_BLOCK ? size : ARENA_BLOCK;
+	struct arena_block* block = malloc(align_up(sizeof(struct arena_block)) + block_size);
+
+	if (!block) return NULL;
+
+	block->next = NULL;
+	block->size = block_size;
+	block->used = size;
+
+	if (a->current) a->current->next = block;
+	else a->first = block;
+
+	a->current = block;
+
+	return block_data(block);
+}
+
+char* arena_strndup(struct arena* a, const char* str, size_t len) {
+	char* copy = arena_alloc(a, len + 1);
+
+	if (!copy) return NULL;
+
+	memcpy(copy, str, len);
+	copy[len] = '\0';
+
+	return copy;
+}
+
+void arena_reset(struct arena* a) {
+	a->current = a->first;
+
+	if (a->current) a->current->used = 0;
+}
+
+void arena_destroy(struct arena* a) {
+	while (a->first) {
+		struct arena_block* block = a->first;
+		a->first = block->next;
+		free(block);
+	}
+
+	a->current = NULL;
+}
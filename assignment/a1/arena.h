@@ -0,0 +1,46 @@
+#ifndef DRAGONSHELL_ARENA_H
+#define DRAGONSHELL_ARENA_H
+
+#include <stddef.h>
+
+// Bump arena: per-command allocations that are all released at once
+
+struct arena_block {
+	struct arena_block* next;
+	size_t size; // Usable bytes after the header
+	size_t used;
+};
+
+struct arena {
+	struct arena_block* first;
+	struct arena_block* current; // Block allocations are being carved from
+};
+
+/**
+ * @brief Start with an empty arena (blocks are allocated on first use)
+ */
+void arena_init(struct arena* a);
+
+/**
+ * @brief Allocate size bytes, aligned for any pointer or integer type
+ *
+ * @return The memory, or NULL if out of memory
+ */
+void* arena_alloc(struct arena* a, size_t size);
+
+/**
+ * @brief Copy len bytes of str into the arena and terminate them
+ */
+char* arena_strndup(struct arena* a, const char* str, size_t len);
+
+/**
+ * @brief Release every allocation in one step, keeping the blocks for reuse
+ */
+void arena_reset(struct arena* a);
+
+/**
+ * @brief Give every block back to the system
+ */
+void arena_destroy(struct arena* a);
+
+#endif
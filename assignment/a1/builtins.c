@@ -0,0 +1,700 @@
+#define _XOPEN_SOURCE 700
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "builtins.h"
+#include "vars.h"
+
+// Escape sequences shared by echo -e, printf formats and %b
+
+/**
+ * @brief Print the escape sequence that starts at the backslash in *p
+ *
+ * @param p - Points at the backslash; moved past the sequence
+ * @param in_format - printf formats take \NNN, echo -e and %b take \0NNN
+ * @return 1 if the sequence was \c (stop printing), 0 otherwise
+ */
+static int put_escape(const char** p, int in_format) {
+	const char* s = *p + 1;
+	int c = *s;
+
+	switch (c) {
+		case 'a': putchar('\a'); break;
+		case 'b': putchar('\b'); break;
+		case 'e': putchar('\033'); break;
+		case 'f': putchar('\f'); break;
+		case 'n': putchar('\n'); break;
+		case 'r': putchar('\r'); break;
+		case 't': putchar('\t'); break;
+		case 'v': putchar('\v'); break;
+		case '\\': putchar('\\'); break;
+		case 'c': *p = s + 1; return 1;
+
+		case '\0':
+			// A lone backslash at the end prints as itself
+			putchar('\\');
+			*p = s;
+			return 0;
+
+		default:
+			if (c >= '0' && c <= '7') {
+				int value = 0, digits = 0;
+
+				if (!in_format && c == '0') s++; // \0NNN: the 0 is not one of the digits
+
+				while (digits < 3 && *s >= '0' && *s <= '7') {
+					value = value * 8 + (*s++ - '0');
+					digits++;
+				}
+
+				putchar(value);
+				*p = s;
+				return 0;
+			}
+
+			// Not an escape: keep both characters
+			putchar('\\');
+			putchar(c);
+	}
+
+	*p = s + 1;
+	return 0;
+}
+
+// echo
+
+int echo_command(char** args) {
+	int newline = 1, escapes = 0;
+	int i = 1;
+
+	// Options only count while every letter is one of n, e, E
+	for (; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0'; ++i) {
+		if (strspn(args[i] + 1, "neE") != strlen(args[i] + 1)) break;
+
+		for (const char* o = args[i] + 1; *o; ++o) {
+			if (*o == 'n') newline = 0;
+			else escapes = (*o == 'e');
+		}
+	}
+
+	for (int first = i; args[i] != NULL; ++i) {
+		if (i > first) putchar(' ');
+
+		if (!escapes) {
+			fputs(args[i], stdout);
+			continue;
+		}
+
+		for (const char* p = args[i]; *p;) {
+			if (*p != '\\') putchar(*p++);
+			else if (put_escape(&p, 0)) return 0;
+		}
+	}
+
+	if (newline) putchar('\n');
+
+	return 0;
+}
+
+// printf
+
+/**
+ * @brief Convert a printf argument; 'c / "c give the character's code
+ *
+ * @return 0 on success, 1 (with a message printed) if arg is not a number
+ */
+static int number_arg(const char* arg, long long* value, int is_unsigned) {
+	if (arg[0] == '\'' || arg[0] == '"') {
+		*value = (unsigned char)arg[1];
+		return 0;
+	}
+
+	char* end;
+	errno = 0;
+	*value = is_unsigned ? (long long)strtoull(arg, &end, 0) : strtoll(arg, &end, 0);
+
+	if (*arg == '\0' || *end != '\0' || errno == ERANGE) {
+		fprintf(stderr, "dragonshell: printf: %s: invalid number\n", arg);
+		return 1;
+	}
+
+	return 0;
+}
+
+int printf_command(char** args) {
+	if (args[1] == NULL) {
+		fprintf(stderr, "dragonshell: printf: usage: printf format [arguments]\n");
+		return 2;
+	}
+
+	const char* format = args[1];
+	char** arg = args + 2;
+	int status = 0;
+
+	// The format is applied again while arguments are left, as long as it consumes some
+	do {
+		char** before = arg;
+
+		for (const char* p = format; *p;) {
+			if (*p == '\\') {
+				if (put_escape(&p, 1)) return status;
+				continue;
+			}
+
+			if (*p != '%') {
+				putchar(*p++);
+				continue;
+			}
+
+			if (p[1] == '%') {
+				putchar('%');
+				p += 2;
+				continue;
+			}
+
+			// Copy flags, width and precision into a C format of our own
+			char spec[32];
+			size_t n = 0;
+			int star[2], n_star = 0;
+
+			spec[n++] = *p++;
+
+			while (*p && strchr("-+ #0", *p) && n < 8) spec[n++] = *p++;
+
+			for (int part = 0; part < 2; ++part) {
+				if (part == 1) {
+					if (*p != '.') break;
+					spec[n++] = *p++;
+				}
+
+				if (*p == '*') {
+					long long value = 0;
+
+					if (*arg && number_arg(*arg++, &value, 0)) status = 1;
+
+					star[n_star++] = (int)value;
+					spec[n++] = *p++;
+				}
+
+				else while (*p >= '0' && *p <= '9' && n < 24) spec[n++] = *p++;
+			}
+
+			char conv = *p;
+
+			if (conv == '\0' || !strchr("sbcdiouxXeEfFgGaA", conv)) {
+				fprintf(stderr, "dragonshell: printf: %%%c: invalid format character\n", conv ? conv : ' ');
+				return 2;
+			}
+
+			p++;
+
+			const char* value = *arg ? *arg++ : NULL;
+
+			if (conv == 'b') {
+				// %b: the argument's own escapes are expanded
+				for (const char* b = value ? value : ""; *b;) {
+					if (*b != '\\') putchar(*b++);
+					else if (put_escape(&b, 0)) return status;
+				}
+
+				continue;
+			}
+
+			if (conv == 'd' || conv == 'i' || conv == 'o' || conv == 'u' || conv == 'x' || conv == 'X') {
+				long long number = 0;
+
+				if (value && number_arg(value, &number, conv != 'd' && conv != 'i')) status = 1;
+
+				spec[n++] = 'l';
+				spec[n++] = 'l';
+				spec[n++] = conv;
+				spec[n] = '\0';
+
+				if (n_star == 2) printf(spec, star[0], star[1], number);
+				else if (n_star == 1) printf(spec, star[0], number);
+				else printf(spec, number);
+
+				continue;
+			}
+
+			spec[n++] = conv;
+			spec[n] = '\0';
+
+			if (conv == 's' || conv == 'c') {
+				const char* str = value ? value : "";
+				int ch = (unsigned char)str[0];
+
+				if (conv == 's') {
+					if (n_star == 2) printf(spec, star[0], star[1], str);
+					else if (n_star == 1) printf(spec, star[0], str);
+					else printf(spec, str);
+				}
+
+				else {
+					if (n_star >= 1) printf(spec, star[0], ch);
+					else printf(spec, ch);
+				}
+
+				continue;
+			}
+
+			// Floating point
+			char* end = NULL;
+			double number = value ? strtod(value, &end) : 0.0;
+
+			if (value && (*value == '\0' || *end != '\0')) {
+				fprintf(stderr, "dragonshell: printf: %s: invalid number\n", value);
+				status = 1;
+			}
+
+			if (n_star == 2) printf(spec, star[0], star[1], number);
+			else if (n_star == 1) printf(spec, star[0], number);
+			else printf(spec, number);
+		}
+
+		if (arg == before) break;
+	} while (*arg);
+
+	return status;
+}
+
+// test / [
+
+static int integer_arg(const char* arg, long long* value) {
+	char* end;
+	errno = 0;
+	*value = strtoll(arg, &end, 10);
+
+	if (*arg == '\0' || *end != '\0' || errno == ERANGE) {
+		fprintf(stderr, "dragonshell: test: %s: integer expression expected\n", arg);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int is_unary(const char* op) {
+	return op[0] == '-' && op[1] != '\0' && op[2] == '\0' && strchr("bcdefghLnprsStuwxz", op[1]);
+}
+
+static int is_binary(const char* op) {
+	static const char* const ops[] = {"=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge", "-nt", "-ot", "-ef", NULL};
+
+	for (int i = 0; ops[i]; ++i)
+		if (strcmp(op, ops[i]) == 0) return 1;
+
+	return 0;
+}
+
+// 0 true, 1 false
+static int test_unary(char op, const char* arg) {
+	struct stat st;
+
+	switch (op) {
+		case 'n': return arg[0] == '\0';
+		case 'z': return arg[0] != '\0';
+		case 'r': return access(arg, R_OK) != 0;
+		case 'w': return access(arg, W_OK) != 0;
+		case 'x': return access(arg, X_OK) != 0;
+		case 't': return !isatty(atoi(arg));
+	}
+
+	if (op == 'h' || op == 'L') return lstat(arg, &st) != 0 || !S_ISLNK(st.st_mode);
+
+	if (stat(arg, &st) != 0) return 1;
+
+	switch (op) {
+		case 'b': return !S_ISBLK(st.st_mode);
+		case 'c': return !S_ISCHR(st.st_mode);
+		case 'd': return !S_ISDIR(st.st_mode);
+		case 'f': return !S_ISREG(st.st_mode);
+		case 'p': return !S_ISFIFO(st.st_mode);
+		case 'S': return !S_ISSOCK(st.st_mode);
+		case 's': return st.st_size == 0;
+		case 'g': return !(st.st_mode & S_ISGID);
+		case 'u': return !(st.st_mode & S_ISUID);
+		default: return 0; // -e
+	}
+}
+
+// 0 true, 1 false, 2 error
+static int test_binary(const char* left, const char* op, const char* right) {
+	if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) return strcmp(left, right) != 0;
+	if (strcmp(op, "!=") == 0) return strcmp(left, right) == 0;
+	if (strcmp(op, "<") == 0) return strcmp(left, right) >= 0;
+	if (strcmp(op, ">") == 0) return strcmp(left, right) <= 0;
+
+	if (strcmp(op, "-nt") == 0 || strcmp(op, "-ot") == 0 || strcmp(op, "-ef") == 0) {
+		struct stat a, b;
+		int have_a = stat(left, &a) == 0, have_b = stat(right, &b) == 0;
+
+		if (op[1] == 'e') return !(have_a && have_b && a.st_dev == b.st_dev && a.st_ino == b.st_ino);
+		if (op[1] == 'n') return !(have_a && (!have_b || a.st_mtime > b.st_mtime));
+		return !(have_b && (!have_a || a.st_mtime < b.st_mtime));
+	}
+
+	long long a, b;
+
+	if (integer_arg(left, &a) < 0 || integer_arg(right, &b) < 0) return 2;
+
+	if (strcmp(op, "-eq") == 0) return !(a == b);
+	if (strcmp(op, "-ne") == 0) return !(a != b);
+	if (strcmp(op, "-lt") == 0) return !(a < b);
+	if (strcmp(op, "-le") == 0) return !(a <= b);
+	if (strcmp(op, "-gt") == 0) return !(a > b);
+	return !(a >= b);
+}
+
+static int test_negate(int result) {
+	return result == 2 ? 2 : !result;
+}
+
+/**
+ * @brief Evaluate argc test arguments following the POSIX rules by count
+ *
+ * @return 0 true, 1 false, 2 error
+ */
+static int test_eval(char** argv, int argc) {
+	switch (argc) {
+		case 0: return 1;
+		case 1: return argv[0][0] == '\0';
+
+		case 2:
+			if (strcmp(argv[0], "!") == 0) return test_negate(test_eval(argv + 1, 1));
+			if (is_unary(argv[0])) return test_unary(argv[0][1], argv[1]);
+			break;
+
+		case 3:
+			if (is_binary(argv[1])) return test_binary(argv[0], argv[1], argv[2]);
+			if (strcmp(argv[0], "!") == 0) return test_negate(test_eval(argv + 1, 2));
+			if (strcmp(argv[0], "(") == 0 && strcmp(argv[2], ")") == 0) return test_eval(argv + 1, 1);
+			break;
+
+		case 4:
+			if (strcmp(argv[0], "!") == 0) return test_negate(test_eval(argv + 1, 3));
+			if (strcmp(argv[0], "(") == 0 && strcmp(argv[3], ")") == 0) return test_eval(argv + 1, 2);
+			break;
+
+		default:
+			fprintf(stderr, "dragonshell: test: too many arguments\n");
+			return 2;
+	}
+
+	fprintf(stderr, "dragonshell: test: %s: unexpected argument\n", argv[argc > 1 ? 1 : 0]);
+	return 2;
+}
+
+int test_command(char** args) {
+	int argc = 0;
+
+	while (args[argc] != NULL) argc++;
+
+	if (strcmp(args[0], "[") == 0) {
+		if (strcmp(args[argc - 1], "]") != 0) {
+			fprintf(stderr, "dragonshell: [: missing `]'\n");
+			return 2;
+		}
+
+		argc--;
+	}
+
+	return test_eval(args + 1, argc - 1);
+}
+
+int true_command(char** args) {
+	(void)args;
+	return 0;
+}
+
+int false_command(char** args) {
+	(void)args;
+	return 1;
+}
+
+// read
+
+/**
+ * @brief Read stdin up to and including the next newline, and no further
+ *
+ * A seekable stdin is read in blocks and rewound to just past the newline;
+ * anything else (terminal, pipe) is read one byte at a time, so whatever
+ * comes after the line is left for the next reader.
+ *
+ * @return The line without its newline (malloc'd), or NULL at end of input
+ * with nothing read; *complete tells whether a newline ended it
+ */
+static char* read_line(int* complete) {
+	size_t len = 0, cap = 128;
+	char* line = malloc(cap);
+	int seekable = lseek(STDIN_FILENO, 0, SEEK_CUR) >= 0;
+
+	*complete = 0;
+
+	if (!line) return NULL;
+
+	while (1) {
+		if (cap - len < 65) {
+			char* bigger = realloc(line, cap * 2);
+
+			if (!bigger) break;
+
+			line = bigger;
+			cap *= 2;
+		}
+
+		ssize_t n = read(STDIN_FILENO, line + len, seekable ? 64 : 1);
+
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) break;
+
+		char* newline = memchr(line + len, '\n', (size_t)n);
+
+		if (newline) {
+			// Give back what was read past the newline
+			if (seekable) lseek(STDIN_FILENO, -(off_t)(line + len + n - newline - 1), SEEK_CUR);
+
+			len = (size_t)(newline - line);
+			*complete = 1;
+			break;
+		}
+
+		len += (size_t)n;
+	}
+
+	if (len == 0 && !*complete) {
+		free(line);
+		return NULL;
+	}
+
+	line[len] = '\0';
+	return line;
+}
+
+int read_command(char** args) {
+	int raw = 0;
+	int i = 1;
+
+	if (args[i] != NULL && strcmp(args[i], "-r") == 0) {
+		raw = 1;
+		i++;
+	}
+
+	char** names = args + i;
+
+	for (int n = 0; names[n] != NULL; ++n) {
+		if (!var_valid_name(names[n], strlen(names[n]))) {
+			fprintf(stderr, "dragonshell: read: `%s': not a valid identifier\n", names[n]);
+			return 1;
+		}
+	}
+
+	/* Without -r, backslashes are removed and the character after one is kept
+	literally; escaped[] remembers which characters those were, so an escaped
+	blank does not split fields */
+	char* text = NULL;
+	char* escaped = NULL;
+	size_t len = 0;
+	int complete = 0;
+
+	while (1) {
+		int line_complete;
+		char* line = read_line(&line_complete);
+
+		if (!line) break;
+
+		size_t line_len = strlen(line);
+		char* grown_text = realloc(text, len + line_len + 1);
+		char* grown_escaped = grown_text ? realloc(escaped, len + line_len + 1) : NULL;
+
+		if (grown_text) text = grown_text;
+
+		if (!grown_escaped) {
+			free(line);
+			break;
+		}
+
+		escaped = grown_escaped;
+
+		int continued = 0;
+
+		for (size_t j = 0; j < line_len; ++j) {
+			int is_escape = !raw && line[j] == '\\';
+
+			if (is_escape && j + 1 == line_len) {
+				continued = line_complete; // Backslash-newline: the line goes on
+				break;
+			}
+
+			if (is_escape) j++;
+
+			text[len] = line[j];
+			escaped[len++] = (char)is_escape;
+		}
+
+		free(line);
+		complete = line_complete;
+
+		if (!continued) break;
+	}
+
+	if (!text) {
+		free(escaped);
+		return 1;
+	}
+
+	text[len] = '\0';
+
+	if (names[0] == NULL) {
+		var_set("REPLY", text);
+	}
+
+	else {
+		size_t pos = 0;
+
+		for (int n = 0; names[n] != NULL; ++n) {
+			while (pos < len && !escaped[pos] && (text[pos] == ' ' || text[pos] == '\t')) pos++;
+
+			size_t start = pos, end;
+
+			if (names[n + 1] == NULL) {
+				// The last name takes the rest of the line, minus trailing blanks
+				end = len;
+
+				while (end > start && !escaped[end - 1] && (text[end - 1] == ' ' || text[end - 1] == '\t')) end--;
+			}
+
+			else {
+				while (pos < len && (escaped[pos] || (text[pos] != ' ' && text[pos] != '\t'))) pos++;
+
+				end = pos;
+			}
+
+			char saved = text[end];
+			text[end] = '\0';
+			var_set(names[n], text + start);
+			text[end] = saved;
+		}
+	}
+
+	free(text);
+	free(escaped);
+
+	return complete ? 0 : 1;
+}
+
+// export, unset, env
+
+static int compare_entries(const void* a, const void* b) {
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/**
+ * @brief Print the exported variables sorted, as export commands that set them again
+ */
+static int list_exports() {
+	char** env = vars_environment();
+	size_t n = 0;
+
+	if (!env) {
+		perror("dragonshell: export");
+		return 1;
+	}
+
+	while (env[n]) n++;
+
+	char** sorted = malloc((n + 1) * sizeof(char*));
+
+	if (!sorted) {
+		perror("dragonshell: export");
+		return 1;
+	}
+
+	memcpy(sorted, env, n * sizeof(char*));
+	qsort(sorted, n, sizeof(char*), compare_entries);
+
+	for (size_t i = 0; i < n; ++i) {
+		const char* eq = strchr(sorted[i], '=');
+
+		printf("export %.*s=\"", (int)(eq - sorted[i]), sorted[i]);
+
+		for (const char* p = eq + 1; *p; ++p) {
+			if (strchr("\\\"$`", *p)) putchar('\\');
+
+			putchar(*p);
+		}
+
+		printf("\"\n");
+	}
+
+	free(sorted);
+	return 0;
+}
+
+int export_command(char** args) {
+	int status = 0;
+	int i = 1;
+
+	if (args[i] != NULL && strcmp(args[i], "-p") == 0) i++;
+
+	if (args[i] == NULL) return list_exports();
+
+	for (; args[i] != NULL; ++i) {
+		size_t name_len = strcspn(args[i], "=");
+
+		if (!var_valid_name(args[i], name_len)) {
+			fprintf(stderr, "dragonshell: export: `%s': not a valid identifier\n", args[i]);
+			status = 1;
+			continue;
+		}
+
+		char saved = args[i][name_len];
+		args[i][name_len] = '\0';
+
+		if ((saved == '=' && var_set(args[i], args[i] + name_len + 1) < 0) || var_export(args[i]) < 0) {
+			perror("dragonshell: export");
+			status = 1;
+		}
+
+		args[i][name_len] = saved;
+	}
+
+	return status;
+}
+
+int unset_command(char** args) {
+	int status = 0;
+	int i = 1;
+
+	if (args[i] != NULL && strcmp(args[i], "-v") == 0) i++;
+
+	for (; args[i] != NULL; ++i) {
+		if (!var_valid_name(args[i], strlen(args[i]))) {
+			fprintf(stderr, "dragonshell: unset: `%s': not a valid identifier\n", args[i]);
+			status = 1;
+			continue;
+		}
+
+		var_unset(args[i]);
+	}
+
+	return status;
+}
+
+int env_command(char** args) {
+	(void)args;
+
+	char** env = vars_environment();
+
+	if (!env) {
+		perror("dragonshell: env");
+		return 1;
+	}
+
+	for (; *env; ++env) puts(*env);
+
+	return 0;
+}
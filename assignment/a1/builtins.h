@@ -0,0 +1,71 @@
+#ifndef DRAGONSHELL_BUILTINS_H
+#define DRAGONSHELL_BUILTINS_H
+
+// Utility builtins: echo, printf, test / [, true, false, read, export, unset
+// and env run inside the shell instead of costing a process each. All of them
+// write through stdio and read from descriptor 0, so the shell's redirections
+// apply.
+
+/**
+ * @brief echo [-neE] [word ...]
+ *
+ * @return The exit status (always 0)
+ */
+int echo_command(char** args);
+
+/**
+ * @brief printf format [argument ...], reusing the format until every argument is used
+ *
+ * @return 0, or 1 if an argument was not a valid number, 2 on a bad format
+ */
+int printf_command(char** args);
+
+/**
+ * @brief test expression / [ expression ]
+ *
+ * @return 0 if the expression is true, 1 if false, 2 on a syntax error
+ */
+int test_command(char** args);
+
+int true_command(char** args);
+
+int false_command(char** args);
+
+/**
+ * @brief read [-r] [name ...]: read one line from stdin and split it into variables
+ *
+ * The last name gets the rest of the line; with no names the line goes to
+ * REPLY. Without -r a backslash escapes the next character and a backslash
+ * before the newline continues the line.
+ *
+ * @return 0, or 1 at end of input or on an invalid name
+ */
+int read_command(char** args);
+
+/**
+ * @brief export [-p] [name[=value] ...]: put variables in the environment of commands
+ *
+ * With no names, prints every exported variable as an export command.
+ *
+ * @return 0, or 1 if a name was not valid
+ */
+int export_command(char** args);
+
+/**
+ * @brief unset [-v] name ...: remove variables
+ *
+ * @return 0, or 1 if a name was not valid
+ */
+int unset_command(char** args);
+
+/**
+ * @brief env: print the environment commands get
+ *
+ * Only the form without arguments is a builtin; env with a command to run
+ * is left to env(1).
+ *
+ * @return 0
+ */
+int env_command(char** args);
+
+#endif
@@ -0,0 +1,471 @@
+#define _XOPEN_SOURCE 700
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "complete.h"
+#include "vars.h"
+
+#define MAX_BUILTINS 64
+#define SPECIAL_CHARS " \t\n\\'\"|&;<>()$`*?[]{}#!" // Escaped with \ when a completion is inserted
+
+/* Command names are kept in a trie stored as one array of nodes, linked
+first-child / next-sibling by index, with the siblings sorted. Looking up a
+prefix touches only the nodes along it, and the names under the prefix come
+out of a walk of its subtree already in order */
+
+struct trie_node {
+	char c;
+	unsigned char terminal; // A name ends here
+	unsigned int child;     // First child, 0 for none (node 0 is the root)
+	unsigned int sibling;   // Next sibling with a larger c, 0 for none
+};
+
+// A $PATH directory as it was when the trie was built
+struct path_dir {
+	char* path;
+	struct timespec mtime;
+	ino_t ino;
+	int exists;
+};
+
+static struct trie_node* nodes = NULL;
+static size_t n_nodes = 0;
+static size_t cap_nodes = 0;
+
+static struct path_dir* dirs = NULL;
+static size_t n_dirs = 0;
+static char* indexed_path = NULL; // Value of $PATH the trie was built from
+
+static const char* builtin_names[MAX_BUILTINS];
+static size_t n_builtins = 0;
+
+static unsigned int new_node(char c) {
+	if (n_nodes == cap_nodes) {
+		size_t cap = cap_nodes ? cap_nodes * 2 : 4096;
+		struct trie_node* bigger = realloc(nodes, cap * sizeof(struct trie_node));
+
+		if (!bigger) return 0;
+
+		nodes = bigger;
+		cap_nodes = cap;
+	}
+
+	struct trie_node* node = &nodes[n_nodes];
+
+	node->c = c;
+	node->terminal = 0;
+	node->child = 0;
+	node->sibling = 0;
+
+	return (unsigned int)n_nodes++;
+}
+
+static int trie_insert(const char* name) {
+	unsigned int node = 0;
+
+	for (const char* p = name; *p; ++p) {
+		unsigned int prev = 0, curr = nodes[node].child;
+
+		while (curr && (unsigned char)nodes[curr].c < (unsigned char)*p) {
+			prev = curr;
+			curr = nodes[curr].sibling;
+		}
+
+		if (!curr || nodes[curr].c != *p) {
+			// Indices, not pointers: new_node may move the array
+			unsigned int fresh = new_node(*p);
+
+			if (!fresh) return -1;
+
+			nodes[fresh].sibling = curr;
+
+			if (prev) nodes[prev].sibling = fresh;
+			else nodes[node].child = fresh;
+
+			curr = fresh;
+		}
+
+		node = curr;
+	}
+
+	nodes[node].terminal = 1;
+	return 0;
+}
+
+static void free_dirs() {
+	for (size_t i = 0; i < n_dirs; ++i) free(dirs[i].path);
+
+	free(dirs);
+	dirs = NULL;
+	n_dirs = 0;
+}
+
+static void stat_dir(struct path_dir* dir) {
+	struct stat st;
+
+	dir->exists = stat(dir->path, &st) == 0;
+	dir->mtime = dir->exists ? st.st_mtim : (struct timespec){0, 0};
+	dir->ino = dir->exists ? st.st_ino : 0;
+}
+
+/**
+ * @brief Add the executables of one directory to the trie
+ */
+static int index_dir(const char* path) {
+	DIR* d = opendir(path);
+
+	if (!d) return 0; // Missing directories are normal in $PATH
+
+	int fd = dirfd(d);
+	int rc = 0;
+	struct dirent* entry;
+
+	while (rc == 0 && (entry = readdir(d)) != NULL) {
+		struct stat st;
+
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+
+		if (fstatat(fd, entry->d_name, &st, 0) < 0 || !S_ISREG(st.st_mode) || !(st.st_mode & 0111)) continue;
+
+		rc = trie_insert(entry->d_name);
+	}
+
+	closedir(d);
+	return rc;
+}
+
+/**
+ * @brief Build the trie from scratch for $PATH (path) and the builtins
+ */
+static int rebuild(const char* path) {
+	free_dirs();
+	free(indexed_path);
+	indexed_path = strdup(path);
+
+	n_nodes = 0;
+	new_node('\0'); // The root
+
+	if (!indexed_path || n_nodes == 0) return -1;
+
+	size_t count = 1;
+
+	for (const char* p = path; *p; ++p)
+		if (*p == ':') count++;
+
+	dirs = calloc(count, sizeof(struct path_dir));
+
+	if (!dirs) return -1;
+
+	for (const char* p = path;; ++p) {
+		const char* end = strchr(p, ':');
+		size_t len = end ? (size_t)(end - p) : strlen(p);
+		struct path_dir* dir = &dirs[n_dirs];
+
+		// An empty entry is the current directory
+		dir->path = len ? strndup(p, len) : strdup(".");
+
+		if (!dir->path) return -1;
+
+		n_dirs++;
+
+		stat_dir(dir);
+
+		if (dir->exists && index_dir(dir->path) < 0) return -1;
+
+		if (!end) break;
+
+		p = end;
+	}
+
+	for (size_t i = 0; i < n_builtins; ++i)
+		if (trie_insert(builtin_names[i]) < 0) return -1;
+
+	return 0;
+}
+
+/**
+ * @brief Rebuild the trie if $PATH or one of its directories changed
+ */
+static int refresh_index() {
+	const char* path = var_get("PATH");
+
+	if (!path) path = "";
+
+	int stale = !indexed_path || strcmp(path, indexed_path) != 0;
+
+	for (size_t i = 0; i < n_dirs && !stale; ++i) {
+		struct path_dir now = dirs[i];
+
+		stat_dir(&now);
+
+		stale = now.exists != dirs[i].exists || now.ino != dirs[i].ino || now.mtime.tv_sec != dirs[i].mtime.tv_sec || now.mtime.tv_nsec != dirs[i].mtime.tv_nsec;
+	}
+
+	if (!stale) return 0;
+
+	if (rebuild(path) < 0) {
+		// A partial trie is not kept; the next completion tries again
+		free(indexed_path);
+		indexed_path = NULL;
+		n_nodes = 0;
+
+		return -1;
+	}
+
+	return 0;
+}
+
+void complete_add_builtin(const char* name) {
+	if (n_builtins < MAX_BUILTINS) builtin_names[n_builtins++] = name;
+
+	// Picked up by the next rebuild
+	free(indexed_path);
+	indexed_path = NULL;
+}
+
+/**
+ * @brief Add a copy of text with the special characters escaped
+ */
+static int add_match(struct matches* m, const char* text) {
+	if (m->n == m->cap) {
+		size_t cap = m->cap ? m->cap * 2 : 32;
+		char** bigger = realloc(m->words, cap * sizeof(char*));
+
+		if (!bigger) return -1;
+
+		m->words = bigger;
+		m->cap = cap;
+	}
+
+	char* word = malloc(2 * strlen(text) + 1);
+
+	if (!word) return -1;
+
+	char* out = word;
+
+	for (const char* p = text; *p; ++p) {
+		if (strchr(SPECIAL_CHARS, *p)) *out++ = '\\';
+
+		*out++ = *p;
+	}
+
+	*out = '\0';
+	m->words[m->n++] = word;
+
+	return 0;
+}
+
+/**
+ * @brief Add every name in the subtree under node, each starting with name[0..len)
+ */
+static int collect(unsigned int node, char* name, size_t len, struct matches* m) {
+	if (nodes[node].terminal) {
+		name[len] = '\0';
+
+		if (add_match(m, name) < 0) return -1;
+	}
+
+	if (len >= NAME_MAX) return 0;
+
+	for (unsigned int child = nodes[node].child; child; child = nodes[child].sibling) {
+		name[len] = nodes[child].c;
+
+		if (collect(child, name, len + 1, m) < 0) return -1;
+	}
+
+	return 0;
+}
+
+static int complete_command(const char* prefix, struct matches* m) {
+	if (refresh_index() < 0) return -1;
+
+	unsigned int node = 0;
+
+	if (n_nodes == 0) return 0;
+
+	for (const char* p = prefix; *p; ++p) {
+		unsigned int child = nodes[node].child;
+
+		while (child && nodes[child].c != *p) child = nodes[child].sibling;
+
+		if (!child) return 0;
+
+		node = child;
+	}
+
+	char name[NAME_MAX + 2];
+	size_t len = strlen(prefix);
+
+	if (len > NAME_MAX) return 0;
+
+	memcpy(name, prefix, len);
+
+	return collect(node, name, len, m);
+}
+
+static int compare_words(const void* a, const void* b) {
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static int complete_path(const char* word, struct matches* m) {
+	const char* slash = strrchr(word, '/');
+	const char* base = slash ? slash + 1 : word;
+	size_t dir_len = slash ? (size_t)(slash - word) + 1 : 0;
+	char dir[PATH_MAX];
+
+	// ~/ is the home directory; the ~ is kept in what gets inserted
+	const char* home = var_get("HOME");
+
+	if (dir_len == 0) strcpy(dir, ".");
+
+	else if (strncmp(word, "~/", 2) == 0 && home) {
+		if ((size_t)snprintf(dir, sizeof(dir), "%s%.*s", home, (int)(dir_len - 1), word + 1) >= sizeof(dir)) return 0;
+	}
+
+	else {
+		if (dir_len >= sizeof(dir)) return 0;
+
+		memcpy(dir, word, dir_len);
+		dir[dir_len] = '\0';
+	}
+
+	DIR* d = opendir(dir);
+
+	if (!d) return 0;
+
+	size_t base_len = strlen(base);
+	char full[PATH_MAX + 1];
+	struct dirent* entry;
+	int rc = 0;
+
+	while (rc == 0 && (entry = readdir(d)) != NULL) {
+		const char* name = entry->d_name;
+		struct stat st;
+
+		if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+
+		// Hidden files only when asked for
+		if (name[0] == '.' && base[0] != '.') continue;
+
+		if (strncmp(name, base, base_len) != 0) continue;
+
+		int is_dir = fstatat(dirfd(d), name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+
+		if (snprintf(full, sizeof(full), "%.*s%s%s", (int)dir_len, word, name, is_dir ? "/" : "") >= (int)sizeof(full)) continue;
+
+		rc = add_match(m, full);
+	}
+
+	closedir(d);
+
+	if (rc < 0) return -1;
+
+	qsort(m->words, m->n, sizeof(char*), compare_words);
+
+	// The directory part is the same in every match; listings show only the names
+	for (size_t i = 0; i < dir_len; ++i) m->prefix_len += strchr(SPECIAL_CHARS, word[i]) ? 2 : 1;
+
+	return 0;
+}
+
+/**
+ * @brief Copy line[start..end) with its quotes and escapes removed
+ */
+static char* unquote(const char* line, size_t start, size_t end) {
+	char* word = malloc(end - start + 1);
+
+	if (!word) return NULL;
+
+	char* out = word;
+	char quote = 0;
+
+	for (size_t i = start; i < end; ++i) {
+		char c = line[i];
+
+		if (quote && c == quote) quote = 0;
+
+		else if (!quote && (c == '\'' || c == '"')) quote = c;
+
+		else if (c == '\\' && quote != '\'' && i + 1 < end) *out++ = line[++i];
+
+		else *out++ = c;
+	}
+
+	*out = '\0';
+	return word;
+}
+
+int complete_word(const char* line, size_t pos, size_t* start, struct matches* m) {
+	m->words = NULL;
+	m->n = 0;
+	m->cap = 0;
+	m->prefix_len = 0;
+
+	// The word ends at the cursor and starts after an unescaped blank or operator
+	size_t begin = 0;
+	char quote = 0;
+
+	for (size_t i = 0; i < pos; ++i) {
+		char c = line[i];
+
+		if (quote) {
+			if (c == quote) quote = 0;
+			else if (c == '\\' && quote == '"') ++i;
+		}
+
+		else if (c == '\\') ++i;
+
+		else if (c == '\'' || c == '"') quote = c;
+
+		else if (strchr(" \t|&;<>()", c)) begin = i + 1;
+	}
+
+	if (begin > pos) begin = pos;
+
+	*start = begin;
+
+	// Command position: nothing but blanks since the start of the line or an operator
+	size_t before = begin;
+
+	while (before > 0 && (line[before - 1] == ' ' || line[before - 1] == '\t')) before--;
+
+	int command = before == 0 || strchr("|&;(", line[before - 1]) != NULL;
+
+	char* word = unquote(line, begin, pos);
+
+	if (!word) return -1;
+
+	int rc = command && !strchr(word, '/') ? complete_command(word, m) : complete_path(word, m);
+
+	free(word);
+
+	if (rc < 0) matches_free(m);
+
+	return rc;
+}
+
+void matches_free(struct matches* m) {
+	for (size_t i = 0; i < m->n; ++i) free(m->words[i]);
+
+	free(m->words);
+
+	m->words = NULL;
+	m->n = 0;
+	m->cap = 0;
+}
+
+void complete_clear() {
+	free(nodes);
+	free_dirs();
+	free(indexed_path);
+
+	nodes = NULL;
+	n_nodes = 0;
+	cap_nodes = 0;
+	indexed_path = NULL;
+}
@@ -0,0 +1,50 @@
+#ifndef DRAGONSHELL_COMPLETE_H
+#define DRAGONSHELL_COMPLETE_H
+
+#include <stddef.h>
+
+// Tab completion: command names from a trie of the executables on $PATH, and paths
+
+struct matches {
+	char** words;      // Replacements for the word being completed, escaped, sorted
+	size_t n;
+	size_t cap;
+	size_t prefix_len; // Leading characters every word shares (the directory), left out of listings
+};
+
+/**
+ * @brief Make a builtin's name part of the command completions
+ *
+ * @param name - Must stay valid while completion is in use
+ */
+void complete_add_builtin(const char* name);
+
+/**
+ * @brief Find the completions of the word the cursor is at the end of
+ *
+ * A word in command position (the start of the line or after |, ;, & or
+ * '(') without a / completes to command names, anything else to paths.
+ * The index of $PATH is checked first: each directory is stat'd, and the
+ * trie is rebuilt only when $PATH or a directory's mtime changed since it
+ * was built, so a completion is a walk down the trie and a scan of the
+ * subtree under the typed prefix.
+ *
+ * @param line - The line being edited
+ * @param pos - The cursor
+ * @param start - Receives where the word being completed starts
+ * @param m - Receives the matches (free them with matches_free); a directory ends with /
+ * @return 0 on success, -1 if out of memory
+ */
+int complete_word(const char* line, size_t pos, size_t* start, struct matches* m);
+
+/**
+ * @brief Free the words of a match list
+ */
+void matches_free(struct matches* m);
+
+/**
+ * @brief Free the command index
+ */
+void complete_clear();
+
+#endif
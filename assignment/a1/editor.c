@@ -0,0 +1,714 @@
+#define _XOPEN_SOURCE 700
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "complete.h"
+#include "editor.h"
+#include "history.h"
+
+#define ESCAPE_TIMEOUT_MS 30 // How long the rest of an escape sequence may take to arrive
+#define LIST_ASK 100         // Completion lists longer than this are only shown when confirmed
+#define MAX_QUERY 256        // Longest history search
+
+#define CTRL_KEY(c) ((c) & 0x1f)
+
+enum key {
+	KEY_LEFT = 256, // Above every byte
+	KEY_RIGHT,
+	KEY_UP,
+	KEY_DOWN,
+	KEY_HOME,
+	KEY_END,
+	KEY_DELETE,
+	KEY_WORD_LEFT,
+	KEY_WORD_RIGHT,
+	KEY_ESCAPE,
+	KEY_IGNORED  // A sequence the editor has no use for
+};
+
+// Everything one redraw writes, sent with one write() so the line does not flicker
+struct output {
+	char* data;
+	size_t len;
+	size_t cap;
+};
+
+static void out_add(struct output* o, const char* text, size_t n) {
+	if (o->len + n > o->cap) {
+		size_t cap = o->cap ? o->cap : 256;
+
+		while (cap < o->len + n) cap *= 2;
+
+		char* bigger = realloc(o->data, cap);
+
+		if (!bigger) return; // The screen is only redrawn in part; the line itself is fine
+
+		o->data = bigger;
+		o->cap = cap;
+	}
+
+	memcpy(o->data + o->len, text, n);
+	o->len += n;
+}
+
+static void out_str(struct output* o, const char* text) {
+	out_add(o, text, strlen(text));
+}
+
+static void out_flush(struct output* o) {
+	size_t done = 0;
+
+	while (done < o->len) {
+		ssize_t n = write(STDOUT_FILENO, o->data + done, o->len - done);
+
+		if (n < 0 && errno == EINTR) continue;
+
+		if (n <= 0) break;
+
+		done += (size_t)n;
+	}
+
+	free(o->data);
+	o->data = NULL;
+	o->len = 0;
+	o->cap = 0;
+}
+
+static void write_str(const char* text) {
+	struct output o = {NULL, 0, 0};
+
+	out_str(&o, text);
+	out_flush(&o);
+}
+
+// UTF-8: a character is a lead byte and its continuation bytes (10xxxxxx)
+
+static size_t prev_char(const char* buf, size_t pos) {
+	do pos--; while (pos > 0 && ((unsigned char)buf[pos] & 0xc0) == 0x80);
+
+	return pos;
+}
+
+static size_t next_char(const char* buf, size_t len, size_t pos) {
+	do pos++; while (pos < len && ((unsigned char)buf[pos] & 0xc0) == 0x80);
+
+	return pos;
+}
+
+static size_t text_width(const char* text, size_t n) {
+	size_t width = 0;
+
+	for (size_t i = 0; i < n; ++i)
+		if (((unsigned char)text[i] & 0xc0) != 0x80) width++;
+
+	return width;
+}
+
+static size_t columns() {
+	struct winsize ws;
+
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0) return ws.ws_col;
+
+	return 80;
+}
+
+/**
+ * @brief Redraw the prompt and a line, scrolled sideways so the cursor is on screen
+ */
+static void draw(const char* prompt, const char* text, size_t len, size_t pos) {
+	size_t cols = columns();
+	size_t prompt_width = text_width(prompt, strlen(prompt));
+	size_t start = 0, end = len;
+
+	while (start < pos && prompt_width + text_width(text + start, pos - start) >= cols) start = next_char(text, len, start);
+
+	while (end > pos && prompt_width + text_width(text + start, end - start) >= cols) end = prev_char(text, end);
+
+	struct output o = {NULL, 0, 0};
+	char move[32];
+
+	out_str(&o, "\r");
+	out_str(&o, prompt);
+	out_add(&o, text + start, end - start);
+	out_str(&o, "\x1b[K\r"); // Clear what a longer line left behind
+
+	size_t col = prompt_width + text_width(text + start, pos - start);
+
+	if (col > 0) {
+		snprintf(move, sizeof(move), "\x1b[%zuC", col);
+		out_str(&o, move);
+	}
+
+	out_flush(&o);
+}
+
+/**
+ * @brief Get the next byte of input, waiting for it
+ *
+ * @return 1 with *c set, 0 at end of input, -1 if wake abandoned the line
+ */
+static int next_byte(struct line_editor* e, unsigned char* c) {
+	while (e->input_pos == e->n_input) {
+		struct pollfd fds[2] = {{e->fd, POLLIN, 0}, {e->wake_fd, POLLIN, 0}};
+		int n = poll(fds, e->wake_fd >= 0 ? 2 : 1, -1);
+
+		if (n < 0 && errno != EINTR) return 0;
+
+		if ((n < 0 || fds[1].revents) && e->wake && e->wake()) return -1;
+
+		if (n <= 0 || !fds[0].revents) continue;
+
+		ssize_t got = read(e->fd, e->input, sizeof(e->input));
+
+		if (got < 0 && errno == EINTR) continue;
+
+		if (got <= 0) return 0;
+
+		e->n_input = (size_t)got;
+		e->input_pos = 0;
+	}
+
+	*c = e->input[e->input_pos++];
+	return 1;
+}
+
+/**
+ * @brief Whether more input arrives within ms milliseconds
+ */
+static int input_soon(struct line_editor* e, int ms) {
+	if (e->input_pos < e->n_input) return 1;
+
+	struct pollfd pfd = {e->fd, POLLIN, 0};
+
+	return poll(&pfd, 1, ms) > 0;
+}
+
+/**
+ * @brief Get the next key, decoding the escape sequences of special keys
+ *
+ * @return Like next_byte, with *key a byte or an enum key
+ */
+static int read_key(struct line_editor* e, int* key) {
+	unsigned char c;
+	int rc;
+
+	if (e->pushed_key >= 0) {
+		*key = e->pushed_key;
+		e->pushed_key = -1;
+
+		return 1;
+	}
+
+	if ((rc = next_byte(e, &c)) <= 0) return rc;
+
+	*key = c;
+
+	if (c != 27) return 1;
+
+	// A lone Escape has nothing after it; a sequence comes in one burst
+	if (!input_soon(e, ESCAPE_TIMEOUT_MS)) {
+		*key = KEY_ESCAPE;
+		return 1;
+	}
+
+	if ((rc = next_byte(e, &c)) <= 0) return rc;
+
+	if (c == 'b' || c == 'f') {
+		*key = c == 'b' ? KEY_WORD_LEFT : KEY_WORD_RIGHT;
+		return 1;
+	}
+
+	if (c != '[' && c != 'O') {
+		*key = KEY_IGNORED;
+		return 1;
+	}
+
+	// CSI: numeric parameters separated by ';', then a final byte
+	int param = 0, modified = 0;
+
+	while (1) {
+		if ((rc = next_byte(e, &c)) <= 0) return rc;
+
+		if (c >= '0' && c <= '9') {
+			if (!modified) param = param * 10 + (c - '0');
+		}
+
+		else if (c == ';') modified = 1;
+
+		else break;
+	}
+
+	switch (c) {
+		case 'A': *key = KEY_UP; break;
+		case 'B': *key = KEY_DOWN; break;
+		case 'C': *key = modified ? KEY_WORD_RIGHT : KEY_RIGHT; break;
+		case 'D': *key = modified ? KEY_WORD_LEFT : KEY_LEFT; break;
+		case 'H': *key = KEY_HOME; break;
+		case 'F': *key = KEY_END; break;
+
+		case '~':
+			if (param == 1 || param == 7) *key = KEY_HOME;
+			else if (param == 4 || param == 8) *key = KEY_END;
+			else if (param == 3) *key = KEY_DELETE;
+			else *key = KEY_IGNORED;
+			break;
+
+		default: *key = KEY_IGNORED;
+	}
+
+	return 1;
+}
+
+static int reserve(struct line_editor* e, size_t len) {
+	if (len + 1 <= e->cap) return 0;
+
+	size_t cap = e->cap ? e->cap : 256;
+
+	while (cap < len + 1) cap *= 2;
+
+	char* bigger = realloc(e->buf, cap);
+
+	if (!bigger) return -1;
+
+	e->buf = bigger;
+	e->cap = cap;
+
+	return 0;
+}
+
+/**
+ * @brief Replace buf[start..end) with text, leaving the cursor after it
+ */
+static int replace(struct line_editor* e, size_t start, size_t end, const char* text, size_t n) {
+	if (reserve(e, e->len - (end - start) + n) < 0) return -1;
+
+	memmove(e->buf + start + n, e->buf + end, e->len - end + 1);
+	memcpy(e->buf + start, text, n);
+
+	e->len = e->len - (end - start) + n;
+	e->pos = start + n;
+
+	return 0;
+}
+
+static void set_line(struct line_editor* e, const char* text) {
+	if (replace(e, 0, e->len, text, strlen(text)) < 0) return;
+
+	e->pos = e->len;
+}
+
+/**
+ * @brief Show history line index instead of the current line
+ */
+static void show_history(struct line_editor* e, int index) {
+	if (index <= history_last() && !history_get(index)) return;
+
+	// The line being typed is kept to come back to
+	if (e->history_index > history_last()) {
+		free(e->draft);
+		e->draft = strdup(e->buf);
+	}
+
+	set_line(e, index <= history_last() ? history_get(index) : e->draft ? e->draft : "");
+	e->history_index = index;
+}
+
+static size_t word_left(const struct line_editor* e) {
+	size_t pos = e->pos;
+
+	while (pos > 0 && e->buf[pos - 1] == ' ') pos--;
+	while (pos > 0 && e->buf[pos - 1] != ' ') pos--;
+
+	return pos;
+}
+
+static size_t word_right(const struct line_editor* e) {
+	size_t pos = e->pos;
+
+	while (pos < e->len && e->buf[pos] == ' ') pos++;
+	while (pos < e->len && e->buf[pos] != ' ') pos++;
+
+	return pos;
+}
+
+/**
+ * @brief Search history backwards from line from for one containing query
+ *
+ * @return Its number, or 0 if none does
+ */
+static int find_history(const char* query, int from) {
+	for (int n = from; n >= history_first() && n > 0; --n) {
+		const char* line = history_get(n);
+
+		if (line && strstr(line, query)) return n;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief ^R: search history as the query is typed
+ *
+ * Every key narrows the search, ^R goes on to older matches and Backspace
+ * widens it again. Enter runs the match, Escape or ^G go back to the line
+ * as it was, and any other key keeps the match and is then handled as usual.
+ *
+ * @return Like next_byte
+ */
+static int search_history(struct line_editor* e) {
+	char query[MAX_QUERY + 1] = "";
+	size_t query_len = 0;
+	int match = 0, failed = 0;
+	char* original = strdup(e->buf);
+	int rc;
+
+	if (!original) return 1;
+
+	while (1) {
+		const char* text = match ? history_get(match) : e->buf;
+		const char* found = match ? strstr(text, query) : NULL;
+		char prompt[MAX_QUERY + 64];
+
+		snprintf(prompt, sizeof(prompt), "(%sreverse-i-search)`%s': ", failed ? "failed " : "", query);
+		draw(prompt, text, strlen(text), found ? (size_t)(found - text) : strlen(text));
+
+		int key;
+
+		if ((rc = read_key(e, &key)) <= 0) break;
+
+		if (key == CTRL_KEY('r')) {
+			int older = find_history(query, match ? match - 1 : history_last());
+
+			if (older) match = older;
+
+			failed = !older;
+		}
+
+		else if (key == 127 || key == CTRL_KEY('h')) {
+			if (query_len > 0) query[--query_len] = '\0';
+
+			match = query_len ? find_history(query, history_last()) : 0;
+			failed = query_len && !match;
+		}
+
+		else if (key >= ' ' && key < 256 && key != 127) {
+			if (query_len < MAX_QUERY) {
+				query[query_len++] = (char)key;
+				query[query_len] = '\0';
+			}
+
+			// The current match may still contain the longer query; a failed search keeps showing it
+			int next = find_history(query, match ? match : history_last());
+
+			if (next) match = next;
+
+			failed = !next;
+		}
+
+		else if (key == KEY_ESCAPE || key == CTRL_KEY('g')) {
+			set_line(e, original);
+			break;
+		}
+
+		else {
+			if (match) {
+				set_line(e, history_get(match));
+				e->history_index = match;
+			}
+
+			e->pushed_key = key;
+			break;
+		}
+	}
+
+	free(original);
+	return rc;
+}
+
+/**
+ * @brief Print the completions below the line, in columns
+ */
+static void list_matches(struct line_editor* e, const struct matches* m) {
+	if (m->n > LIST_ASK) {
+		char question[64];
+		int key = 0;
+
+		snprintf(question, sizeof(question), "\nDisplay all %zu possibilities? (y or n)", m->n);
+		write_str(question);
+
+		if (read_key(e, &key) <= 0 || (key != 'y' && key != 'Y')) {
+			write_str("\n");
+			return;
+		}
+	}
+
+	size_t width = 0;
+
+	for (size_t i = 0; i < m->n; ++i) {
+		size_t w = strlen(m->words[i]) - m->prefix_len;
+
+		if (w > width) width = w;
+	}
+
+	size_t per_row = columns() / (width + 2);
+
+	if (per_row == 0) per_row = 1;
+
+	struct output o = {NULL, 0, 0};
+
+	out_str(&o, "\n");
+
+	for (size_t i = 0; i < m->n; ++i) {
+		const char* name = m->words[i] + m->prefix_len;
+		size_t w = strlen(name);
+
+		out_add(&o, name, w);
+
+		if ((i + 1) % per_row == 0 || i + 1 == m->n) out_str(&o, "\n");
+
+		else for (; w < width + 2; ++w) out_str(&o, " ");
+	}
+
+	out_flush(&o);
+}
+
+/**
+ * @brief Tab: complete the word before the cursor as far as it is unambiguous
+ */
+static void complete(struct line_editor* e) {
+	struct matches m;
+	size_t start;
+
+	if (complete_word(e->buf, e->pos, &start, &m) < 0 || m.n == 0) {
+		write_str("\a");
+		return;
+	}
+
+	// Longest common prefix, not ending halfway through an escape
+	size_t common = strlen(m.words[0]);
+
+	for (size_t i = 1; i < m.n; ++i) {
+		size_t j = 0;
+
+		while (j < common && m.words[i][j] == m.words[0][j]) j++;
+
+		common = j;
+	}
+
+	size_t slashes = 0;
+
+	while (slashes < common && m.words[0][common - 1 - slashes] == '\\') slashes++;
+
+	if (slashes % 2) common--;
+
+	size_t typed = e->pos - start;
+
+	if (m.n == 1) {
+		replace(e, start, e->pos, m.words[0], common);
+
+		// A directory is usually completed further
+		if (m.words[0][common - 1] != '/') replace(e, e->pos, e->pos, " ", 1);
+	}
+
+	else if (common != typed || memcmp(e->buf + start, m.words[0], common) != 0) replace(e, start, e->pos, m.words[0], common);
+
+	else if (e->last_was_tab) list_matches(e, &m);
+
+	else write_str("\a");
+
+	matches_free(&m);
+}
+
+void editor_init(struct line_editor* e, int fd, int wake_fd, int (*wake)(void)) {
+	memset(e, 0, sizeof(*e));
+
+	e->fd = fd;
+	e->wake_fd = wake_fd;
+	e->wake = wake;
+	e->pushed_key = -1;
+}
+
+int editor_read(struct line_editor* e, const char* prompt, char** line) {
+	struct termios saved, raw;
+
+	if (reserve(e, 0) < 0) return 0;
+
+	e->len = 0;
+	e->pos = 0;
+	e->buf[0] = '\0';
+	e->history_index = history_last() + 1;
+	e->last_was_tab = 0;
+
+	free(e->draft);
+	e->draft = NULL;
+
+	// Output the shell buffered goes before the prompt
+	fflush(stdout);
+
+	if (tcgetattr(e->fd, &saved) < 0) return 0;
+
+	/* No echo and no line buffering; signals stay on, so ^C and ^Z still reach
+	the shell's handlers, and output processing stays on, so \n still returns */
+	raw = saved;
+	raw.c_iflag &= ~(tcflag_t)(ICRNL | INLCR | IGNCR | IXON);
+	raw.c_lflag &= ~(tcflag_t)(ICANON | ECHO | IEXTEN);
+	raw.c_cc[VMIN] = 1;
+	raw.c_cc[VTIME] = 0;
+
+	tcsetattr(e->fd, TCSADRAIN, &raw);
+
+	int rc = 1, done = 0;
+
+	draw(prompt, e->buf, e->len, e->pos);
+
+	while (!done) {
+		int key;
+		size_t old_len = e->len;
+		size_t old_pos = e->pos;
+
+		if ((rc = read_key(e, &key)) <= 0) break;
+
+		int tab = key == '\t';
+
+		switch (key) {
+			case '\r':
+			case '\n':
+				done = 1;
+				break;
+
+			case CTRL_KEY('d'):
+				if (e->len == 0) {
+					rc = 0;
+					done = 1;
+				}
+
+				else if (e->pos < e->len) replace(e, e->pos, next_char(e->buf, e->len, e->pos), "", 0);
+
+				break;
+
+			case 127:
+			case CTRL_KEY('h'):
+				if (e->pos > 0) replace(e, prev_char(e->buf, e->pos), e->pos, "", 0);
+				break;
+
+			case KEY_DELETE:
+				if (e->pos < e->len) replace(e, e->pos, next_char(e->buf, e->len, e->pos), "", 0);
+				break;
+
+			case KEY_LEFT:
+			case CTRL_KEY('b'):
+				if (e->pos > 0) e->pos = prev_char(e->buf, e->pos);
+				break;
+
+			case KEY_RIGHT:
+			case CTRL_KEY('f'):
+				if (e->pos < e->len) e->pos = next_char(e->buf, e->len, e->pos);
+				break;
+
+			case KEY_HOME:
+			case CTRL_KEY('a'):
+				e->pos = 0;
+				break;
+
+			case KEY_END:
+			case CTRL_KEY('e'):
+				e->pos = e->len;
+				break;
+
+			case KEY_WORD_LEFT:
+				e->pos = word_left(e);
+				break;
+
+			case KEY_WORD_RIGHT:
+				e->pos = word_right(e);
+				break;
+
+			case CTRL_KEY('k'):
+				e->len = e->pos;
+				e->buf[e->len] = '\0';
+				break;
+
+			case CTRL_KEY('u'):
+				replace(e, 0, e->pos, "", 0);
+				break;
+
+			case CTRL_KEY('w'):
+				replace(e, word_left(e), e->pos, "", 0);
+				break;
+
+			case CTRL_KEY('l'):
+				write_str("\x1b[H\x1b[2J");
+				break;
+
+			case KEY_UP:
+			case CTRL_KEY('p'):
+				if (e->history_index > history_first()) show_history(e, e->history_index - 1);
+				break;
+
+			case KEY_DOWN:
+			case CTRL_KEY('n'):
+				if (e->history_index <= history_last()) show_history(e, e->history_index + 1);
+				break;
+
+			case CTRL_KEY('r'):
+				rc = search_history(e);
+				done = rc <= 0;
+				break;
+
+			case '\t':
+				complete(e);
+				break;
+
+			default:
+				if (key >= ' ' && key < 256 && key != 127) {
+					char c = (char)key;
+
+					replace(e, e->pos, e->pos, &c, 1);
+				}
+		}
+
+		e->last_was_tab = tab;
+
+		if (done) break;
+
+		// Typing at the end of a line that fits only needs the new character echoed
+		if (old_pos == old_len && e->pos == e->len && e->len == old_len + 1 && key != '\t'
+			&& text_width(prompt, strlen(prompt)) + text_width(e->buf, e->len) < columns()) {
+			char c = e->buf[e->len - 1];
+
+			if (write(STDOUT_FILENO, &c, 1) < 0) draw(prompt, e->buf, e->len, e->pos);
+		}
+
+		else draw(prompt, e->buf, e->len, e->pos);
+	}
+
+	if (rc > 0) {
+		// A line scrolled sideways is shown from its start before moving below it
+		if (text_width(prompt, strlen(prompt)) + text_width(e->buf, e->len) >= columns()) draw(prompt, e->buf, e->len, e->len);
+
+		write_str("\n");
+	}
+
+	else if (rc == 0 && done) write_str("\n");
+
+	tcsetattr(e->fd, TCSADRAIN, &saved);
+
+	if (rc > 0) *line = e->buf;
+
+	return rc;
+}
+
+void editor_close(struct line_editor* e) {
+	free(e->buf);
+	free(e->draft);
+
+	e->buf = NULL;
+	e->draft = NULL;
+	e->cap = 0;
+}
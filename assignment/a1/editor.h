@@ -0,0 +1,54 @@
+#ifndef DRAGONSHELL_EDITOR_H
+#define DRAGONSHELL_EDITOR_H
+
+#include <stddef.h>
+
+// Line editor: reads keys from a terminal in raw mode and redraws the line as it changes
+
+struct line_editor {
+	int fd;              // Terminal the keys come from; the line is drawn on stdout
+	int wake_fd;         // Polled along with fd, readable when wake has work (or -1)
+	int (*wake)(void);   // Called when wake_fd is readable; nonzero abandons the line
+
+	char* buf;           // Line being edited, always terminated
+	size_t len;
+	size_t cap;
+	size_t pos;          // Cursor, a byte offset into buf
+
+	unsigned char input[512]; // Bytes read but not handled yet (typed ahead or pasted)
+	size_t n_input;
+	size_t input_pos;
+	int pushed_key;      // Key to handle again (the one that ended a history search), or -1
+
+	int history_index;   // Line of history shown, history_last() + 1 for the one being typed
+	char* draft;         // The line being typed, kept while history is shown instead
+	int last_was_tab;    // A second Tab in a row lists the completions
+};
+
+/**
+ * @brief Set up an editor reading from a terminal
+ */
+void editor_init(struct line_editor* e, int fd, int wake_fd, int (*wake)(void));
+
+/**
+ * @brief Read one line, editing it in place on the screen
+ *
+ * The terminal is in raw mode only while this runs, so commands see it the
+ * way they expect. Keys: arrows, Home/End, ^A ^E ^B ^F, Alt-b/Alt-f (and
+ * Ctrl-arrows) by word, Backspace/Delete, ^D (end of input on an empty
+ * line), ^K ^U ^W, ^L, Up/Down (^P/^N) through history, ^R for an
+ * incremental search of history, and Tab to complete commands and paths
+ * (a second Tab lists the choices).
+ *
+ * @param prompt - Printed before the line
+ * @param line - Receives the line, without its newline; valid until the next call
+ * @return 1 with *line set, 0 at end of input, -1 if wake abandoned the line
+ */
+int editor_read(struct line_editor* e, const char* prompt, char** line);
+
+/**
+ * @brief Free the editor's buffers
+ */
+void editor_close(struct line_editor* e);
+
+#endif
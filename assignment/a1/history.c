@@ -0,0 +1,312 @@
+#define _XOPEN_SOURCE 700
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "history.h"
+
+#define HISTORY_FILE_SIZE (1024 * 1024 + sizeof(struct history_header)) // 1 MiB ring
+#define HISTORY_MAGIC 0x31485344u // "DSH1"
+
+/* File layout: a header, then a ring of records. Positions are absolute byte
+counts that only grow; a record lives at position % capacity.
+
+Each record is [u64 length][text][padding to 8][u64 start position]. The
+trailer is written last, so a reader walking back from head knows a record is
+complete and from the current lap when its trailer names the position its
+length leads back to. A record that is still being written, or whose bytes
+were overwritten by a later lap, fails that check and ends the walk */
+
+struct history_header {
+	uint32_t magic;   // 0 in a fresh zero-filled file, claimed with a compare-and-swap
+	uint32_t unused;
+	uint64_t head;    // Bytes ever reserved, advanced with an atomic add
+};
+
+static struct history_header* file_header = NULL;
+static char* file_ring = NULL;
+static uint64_t file_capacity = 0;
+static size_t file_size = 0;
+
+static char* lines[HISTORY_SIZE]; // lines[n % HISTORY_SIZE] is line number n
+static int first_number = 1;
+static int last_number = 0;
+
+static uint64_t align8(uint64_t n) {
+	return (n + 7) & ~(uint64_t)7;
+}
+
+// Copy between the ring and a flat buffer, wrapping at the end of the ring
+
+static void ring_write(uint64_t pos, const void* data, uint64_t len) {
+	uint64_t offset = pos % file_capacity;
+	uint64_t first = len < file_capacity - offset ? len : file_capacity - offset;
+
+	memcpy(file_ring + offset, data, first);
+	memcpy(file_ring, (const char*)data + first, len - first);
+}
+
+static void ring_read(uint64_t pos, void* data, uint64_t len) {
+	uint64_t offset = pos % file_capacity;
+	uint64_t first = len < file_capacity - offset ? len : file_capacity - offset;
+
+	memcpy(data, file_ring + offset, first);
+	memcpy((char*)data + first, file_ring, len - first);
+}
+
+static uint64_t ring_u64(uint64_t pos) {
+	// Fields are 8-aligned and the capacity is a multiple of 8, so they never wrap
+	return __atomic_load_n((uint64_t*)(file_ring + pos % file_capacity), __ATOMIC_ACQUIRE);
+}
+
+static void remember(const char* line) {
+	char* copy = strdup(line);
+
+	if (!copy) return;
+
+	last_number++;
+
+	// The ring is full: the oldest line makes room
+	if (last_number - first_number >= HISTORY_SIZE) {
+		free(lines[first_number % HISTORY_SIZE]);
+		first_number++;
+	}
+
+	lines[last_number % HISTORY_SIZE] = copy;
+}
+
+/**
+ * @brief Load the newest records of the file into memory, oldest first
+ */
+static void load_recent() {
+	uint64_t head = __atomic_load_n(&file_header->head, __ATOMIC_ACQUIRE);
+	uint64_t starts[HISTORY_SIZE];
+	int n = 0;
+
+	// Walk back from head collecting record positions
+	for (uint64_t pos = head; n < HISTORY_SIZE && pos >= 16;) {
+		uint64_t start = ring_u64(pos - 8);
+
+		if (start >= pos || pos - start < 16 || head - start > file_capacity) break;
+
+		uint64_t len = ring_u64(start);
+
+		if (16 + align8(len) != pos - start) break;
+
+		starts[n++] = start;
+		pos = start;
+	}
+
+	char* text = NULL;
+	uint64_t text_cap = 0;
+
+	while (n-- > 0) {
+		uint64_t len = ring_u64(starts[n]);
+
+		if (len + 1 > text_cap) {
+			char* bigger = realloc(text, len + 1);
+
+			if (!bigger) break;
+
+			text = bigger;
+			text_cap = len + 1;
+		}
+
+		ring_read(starts[n] + 8, text, len);
+		text[len] = '\0';
+
+		// Another shell may have lapped the ring while we copied
+		if (__atomic_load_n(&file_header->head, __ATOMIC_ACQUIRE) - starts[n] > file_capacity) continue;
+
+		remember(text);
+	}
+
+	free(text);
+}
+
+void history_open(const char* path) {
+	if (!path) return;
+
+	int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+
+	if (fd < 0) return;
+
+	struct stat st;
+
+	// Growing a fresh file is harmless to repeat: the new bytes are zero either way
+	if (fstat(fd, &st) < 0 || (st.st_size == 0 && ftruncate(fd, (off_t)HISTORY_FILE_SIZE) < 0) || fstat(fd, &st) < 0) {
+		close(fd);
+		return;
+	}
+
+	size_t size = (size_t)st.st_size & ~(size_t)7;
+
+	if (size < sizeof(struct history_header) + 4096) {
+		close(fd);
+		return;
+	}
+
+	void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED) return;
+
+	struct history_header* header = map;
+	uint32_t expected = 0;
+
+	// The first shell to see a fresh file stamps it; anything else is not ours
+	if (!__atomic_compare_exchange_n(&header->magic, &expected, HISTORY_MAGIC, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) &&
+		expected != HISTORY_MAGIC) {
+		munmap(map, size);
+		return;
+	}
+
+	file_header = header;
+	file_ring = (char*)map + sizeof(struct history_header);
+	file_capacity = size - sizeof(struct history_header);
+	file_size = size;
+
+	load_recent();
+}
+
+void history_add(const char* line) {
+	remember(line);
+
+	if (!file_header) return;
+
+	uint64_t len = strlen(line);
+	uint64_t size = 16 + align8(len);
+
+	// Lines that would take over a quarter of the ring stay in memory only
+	if (size > file_capacity / 4) return;
+
+	uint64_t start = __atomic_fetch_add(&file_header->head, size, __ATOMIC_ACQ_REL);
+
+	ring_write(start, &len, 8);
+	ring_write(start + 8, line, len);
+
+	// Publish: the trailer goes in last
+	__atomic_store_n((uint64_t*)(file_ring + (start + size - 8) % file_capacity), start, __ATOMIC_RELEASE);
+}
+
+int history_first() {
+	return first_number;
+}
+
+int history_last() {
+	return last_number;
+}
+
+const char* history_get(int n) {
+	if (n < first_number || n > last_number) return NULL;
+
+	return lines[n % HISTORY_SIZE];
+}
+
+void history_clear() {
+	for (int n = first_number; n <= last_number; ++n) free(lines[n % HISTORY_SIZE]);
+
+	first_number = last_number + 1;
+}
+
+/**
+ * @brief Append len bytes to a growing malloc'd string
+ */
+static int append(char** out, size_t* len, size_t* cap, const char* text, size_t n) {
+	if (*len + n + 1 > *cap) {
+		size_t new_cap = *cap ? *cap : 128;
+
+		while (new_cap < *len + n + 1) new_cap *= 2;
+
+		char* bigger = realloc(*out, new_cap);
+
+		if (!bigger) return -1;
+
+		*out = bigger;
+		*cap = new_cap;
+	}
+
+	memcpy(*out + *len, text, n);
+	*len += n;
+	(*out)[*len] = '\0';
+
+	return 0;
+}
+
+int history_expand(const char* line, char** expanded) {
+	char* out = NULL;
+	size_t len = 0, cap = 0;
+	int in_single = 0, in_double = 0, changed = 0;
+	const char* copied = line; // Everything before this is already in out
+
+	for (const char* p = line; *p; ++p) {
+		if (*p == '\\' && !in_single && p[1] != '\0') {
+			p++;
+			continue;
+		}
+
+		if (*p == '\'' && !in_double) in_single = !in_single;
+		if (*p == '"' && !in_single) in_double = !in_double;
+
+		if (*p != '!' || in_single || p[1] == '\0' || strchr(" \t=(\"", p[1])) continue;
+
+		const char* end;
+		int number;
+
+		if (p[1] == '!') {
+			number = last_number;
+			end = p + 2;
+		}
+
+		else if ((p[1] >= '0' && p[1] <= '9') || (p[1] == '-' && p[2] >= '0' && p[2] <= '9')) {
+			char* stop;
+			long n = strtol(p + 1, &stop, 10);
+
+			number = n < 0 ? last_number + 1 + (int)n : (int)n;
+			end = stop;
+		}
+
+		else continue;
+
+		const char* event = history_get(number);
+
+		if (!event) {
+			fprintf(stderr, "dragonshell: %.*s: event not found\n", (int)(end - p), p);
+			free(out);
+			return -1;
+		}
+
+		if (append(&out, &len, &cap, copied, (size_t)(p - copied)) < 0 || append(&out, &len, &cap, event, strlen(event)) < 0) {
+			free(out);
+			return -1;
+		}
+
+		copied = end;
+		p = end - 1;
+		changed = 1;
+	}
+
+	if (!changed) return 0;
+
+	if (append(&out, &len, &cap, copied, strlen(copied)) < 0) {
+		free(out);
+		return -1;
+	}
+
+	*expanded = out;
+	return 1;
+}
+
+void history_close() {
+	history_clear();
+
+	if (file_header) munmap(file_header, file_size);
+
+	file_header = NULL;
+	file_ring = NULL;
+}
@@ -0,0 +1,67 @@
+#ifndef DRAGONSHELL_HISTORY_H
+#define DRAGONSHELL_HISTORY_H
+
+// Command history: an in-memory ring of recent lines, backed by a fixed-size
+// ring file that every shell appends to without locks
+
+#define HISTORY_SIZE 1000 // Lines kept in memory (and loaded at startup)
+
+/**
+ * @brief Start the history, loading the most recent lines of the file
+ *
+ * The file is created (zero-filled, so it needs no further setup) if it does
+ * not exist. Only the newest HISTORY_SIZE records are read, walking back from
+ * the end of the ring, so startup cost does not grow with the file.
+ *
+ * @param path - The history file, or NULL to keep history in memory only
+ */
+void history_open(const char* path);
+
+/**
+ * @brief Remember a line, in memory and in the file
+ *
+ * The append to the file reserves its bytes with one atomic add on the
+ * shared header and then copies the line in, so concurrent shells never
+ * overwrite each other and nobody waits on a lock.
+ */
+void history_add(const char* line);
+
+/**
+ * @brief Number of the oldest line still held (1 if history is empty)
+ */
+int history_first();
+
+/**
+ * @brief Number of the newest line, 0 if history is empty
+ */
+int history_last();
+
+/**
+ * @brief The line with number n, or NULL if it is not held
+ */
+const char* history_get(int n);
+
+/**
+ * @brief Forget the in-memory lines (the file is kept)
+ */
+void history_clear();
+
+/**
+ * @brief Expand !!, !n and !-n in a line
+ *
+ * Not inside single quotes, and not when ! is escaped or followed by a
+ * blank, '=' or the end of the line.
+ *
+ * @param line - The input line
+ * @param expanded - Receives a malloc'd copy with the events substituted
+ * @return 1 if something was expanded, 0 if the line has no events (nothing
+ * is allocated), -1 (with a message printed) if an event does not exist
+ */
+int history_expand(const char* line, char** expanded);
+
+/**
+ * @brief Unmap the file and free the in-memory lines
+ */
+void history_close();
+
+#endif
@@ -0,0 +1,260 @@
+#define _XOPEN_SOURCE 700
+#include <stdlib.h>
+#include <string.h>
+
+#include "jobs.h"
+
+#define SLAB_OBJECTS 64    // Objects carved out of each slab
+#define MIN_PID_BUCKETS 64 // Initial size of the pid hash, doubled as it fills up
+
+/* Slab allocator: objects of one size are carved out of slabs of SLAB_OBJECTS
+and recycled through a free list, so adding and removing jobs never calls
+malloc/free once the table has warmed up */
+
+struct slab_pool {
+	size_t size;     // Object size, a multiple of sizeof(void*)
+	void* free_list; // Free objects, linked through their first word
+	void* slabs;     // Every slab, linked through their first word
+};
+
+static struct slab_pool job_pool = {sizeof(struct job), NULL, NULL};
+static struct slab_pool process_pool = {sizeof(struct job_process), NULL, NULL};
+
+static struct job_process** pid_buckets = NULL;
+static size_t n_pid_buckets = 0;
+static size_t n_processes = 0;
+
+static struct job** id_table = NULL; // id_table[id] is job %id, or NULL
+static int id_capacity = 0;
+static int top_id = 0;
+
+static void* slab_alloc(struct slab_pool* pool) {
+	if (pool->free_list == NULL) {
+		size_t size = (pool->size + sizeof(void*) - 1) / sizeof(void*) * sizeof(void*);
+		char* slab = malloc(sizeof(void*) + SLAB_OBJECTS * size);
+
+		if (!slab) return NULL;
+
+		*(void**)slab = pool->slabs;
+		pool->slabs = slab;
+
+		for (int i = SLAB_OBJECTS - 1; i >= 0; --i) {
+			void* obj = slab + sizeof(void*) + (size_t)i * size;
+
+			*(void**)obj = pool->free_list;
+			pool->free_list = obj;
+		}
+	}
+
+	void* obj = pool->free_list;
+	pool->free_list = *(void**)obj;
+
+	return obj;
+}
+
+static void slab_free(struct slab_pool* pool, void* obj) {
+	*(void**)obj = pool->free_list;
+	pool->free_list = obj;
+}
+
+static void slab_destroy(struct slab_pool* pool) {
+	while (pool->slabs) {
+		void* slab = pool->slabs;
+		pool->slabs = *(void**)slab;
+		free(slab);
+	}
+
+	pool->free_list = NULL;
+}
+
+static size_t pid_bucket(pid_t pid) {
+	return (size_t)pid & (n_pid_buckets - 1);
+}
+
+/**
+ * @brief Double the pid hash (rehashing every process) once it is full
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+static int grow_pid_buckets() {
+	size_t size = n_pid_buckets ? n_pid_buckets * 2 : MIN_PID_BUCKETS;
+	struct job_process** buckets = calloc(size, sizeof(struct job_process*));
+
+	if (!buckets) return -1;
+
+	size_t old_size = n_pid_buckets;
+	struct job_process** old = pid_buckets;
+
+	pid_buckets = buckets;
+	n_pid_buckets = size;
+
+	for (size_t i = 0; i < old_size; ++i) {
+		while (old[i]) {
+			struct job_process* proc = old[i];
+			old[i] = proc->hash_next;
+
+			proc->hash_next = pid_buckets[pid_bucket(proc->pid)];
+			pid_buckets[pid_bucket(proc->pid)] = proc;
+		}
+	}
+
+	free(old);
+	return 0;
+}
+
+static struct job_process* find_process(pid_t pid) {
+	if (n_pid_buckets == 0) return NULL;
+
+	for (struct job_process* proc = pid_buckets[pid_bucket(pid)]; proc; proc = proc->hash_next)
+		if (proc->pid == pid) return proc;
+
+	return NULL;
+}
+
+static void unhash_process(struct job_process* proc) {
+	struct job_process** curr = &pid_buckets[pid_bucket(proc->pid)];
+
+	while (*curr) {
+		if (*curr == proc) {
+			*curr = proc->hash_next;
+			break;
+		}
+
+		curr = &(*curr)->hash_next;
+	}
+
+	proc->pid = 0; // Exited: no longer reachable by pid
+	n_processes--;
+}
+
+struct job* add_job(pid_t pgid, char state, const char* cmd) {
+	if (top_id + 1 >= id_capacity) {
+		int capacity = id_capacity ? id_capacity * 2 : 16;
+		struct job** table = realloc(id_table, (size_t)capacity * sizeof(struct job*));
+
+		if (!table) return NULL;
+
+		memset(table + id_capacity, 0, (size_t)(capacity - id_capacity) * sizeof(struct job*));
+		id_table = table;
+		id_capacity = capacity;
+	}
+
+	struct job* new_job = slab_alloc(&job_pool);
+
+	if (!new_job) return NULL;
+
+	new_job->cmd = strdup(cmd);
+
+	if (!new_job->cmd) {
+		slab_free(&job_pool, new_job);
+		return NULL;
+	}
+
+	new_job->id = ++top_id;
+	new_job->pgid = pgid;
+	new_job->state = state;
+	new_job->live = 0;
+	new_job->last_pid = 0;
+	new_job->procs = NULL;
+	memset(&new_job->usage, 0, sizeof(new_job->usage));
+
+	id_table[new_job->id] = new_job;
+
+	return new_job;
+}
+
+int add_job_process(struct job* job, pid_t pid) {
+	if (n_processes >= n_pid_buckets && grow_pid_buckets() < 0) return -1;
+
+	struct job_process* proc = slab_alloc(&process_pool);
+
+	if (!proc) return -1;
+
+	proc->pid = pid;
+	proc->job = job;
+
+	proc->hash_next = pid_buckets[pid_bucket(pid)];
+	pid_buckets[pid_bucket(pid)] = proc;
+
+	proc->job_next = job->procs;
+	job->procs = proc;
+
+	job->live++;
+	n_processes++;
+
+	return 0;
+}
+
+struct job* find_job(pid_t pid) {
+	struct job_process* proc = find_process(pid);
+
+	return proc ? proc->job : NULL;
+}
+
+struct job* find_job_id(int id) {
+	if (id <= 0 || id > top_id) return NULL;
+
+	return id_table[id];
+}
+
+int max_job_id() {
+	return top_id;
+}
+
+void remove_job(struct job* job) {
+	while (job->procs) {
+		struct job_process* proc = job->procs;
+		job->procs = proc->job_next;
+
+		if (proc->pid != 0) unhash_process(proc);
+		slab_free(&process_pool, proc);
+	}
+
+	id_table[job->id] = NULL;
+
+	// The next job reuses the IDs freed at the top, like bash does
+	while (top_id > 0 && id_table[top_id] == NULL) top_id--;
+
+	free(job->cmd);
+	slab_free(&job_pool, job);
+}
+
+void update_job(pid_t pid, char state) {
+	struct job* job = find_job(pid);
+
+	if (job) job->state = state;
+}
+
+int reap_job_process(pid_t pid) {
+	struct job_process* proc = find_process(pid);
+
+	if (!proc) return 0;
+
+	struct job* job = proc->job;
+
+	unhash_process(proc);
+
+	if (--job->live > 0) return 0;
+
+	remove_job(job);
+	return 1;
+}
+
+void clear_jobs() {
+	for (int id = 1; id <= top_id; ++id)
+		if (id_table[id]) free(id_table[id]->cmd);
+
+	slab_destroy(&job_pool);
+	slab_destroy(&process_pool);
+
+	free(pid_buckets);
+	free(id_table);
+
+	pid_buckets = NULL;
+	n_pid_buckets = 0;
+	n_processes = 0;
+
+	id_table = NULL;
+	id_capacity = 0;
+	top_id = 0;
+}
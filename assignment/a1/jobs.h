@@ -0,0 +1,82 @@
+#ifndef DRAGONSHELL_JOBS_H
+#define DRAGONSHELL_JOBS_H
+
+#include <sys/types.h>
+#include <sys/resource.h>
+
+// Job table: constant time insert, lookup and remove by pid or job ID
+
+struct job;
+
+struct job_process {
+	pid_t pid;
+	struct job* job;
+
+	struct job_process* hash_next; // Next process in the same pid bucket
+	struct job_process* job_next;  // Next process of the same job
+};
+
+struct job {
+	int id;      // Small job number, %1, %2, ...
+	pid_t pgid;  // Process group shared by every process of the job
+	char state;  // 'R' running, 'T' stopped
+	char* cmd;
+	int live;    // Processes of the job that have not exited yet
+	pid_t last_pid; // Last stage of the pipeline, whose status is the job's status
+	struct rusage usage; // Summed over the processes reaped so far
+
+	struct job_process* procs;
+};
+
+/**
+ * @brief Create a job with the lowest ID above every job still in the table
+ *
+ * @return The new job (with no processes yet), or NULL if out of memory
+ */
+struct job* add_job(pid_t pgid, char state, const char* cmd);
+
+/**
+ * @brief Record that pid is one of job's processes
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+int add_job_process(struct job* job, pid_t pid);
+
+/**
+ * @brief Find the job a process belongs to
+ */
+struct job* find_job(pid_t pid);
+
+/**
+ * @brief Find a job by its job ID
+ */
+struct job* find_job_id(int id);
+
+/**
+ * @brief Highest job ID in use, 0 when the table is empty
+ */
+int max_job_id();
+
+/**
+ * @brief Remove a job with all of its processes
+ */
+void remove_job(struct job* job);
+
+/**
+ * @brief Set the state of the job that pid belongs to
+ */
+void update_job(pid_t pid, char state);
+
+/**
+ * @brief Note that a process exited; its job goes away with its last process
+ *
+ * @return 1 if that was the job's last process, 0 otherwise
+ */
+int reap_job_process(pid_t pid);
+
+/**
+ * @brief Drop every job and give all table memory back
+ */
+void clear_jobs();
+
+#endif
@@ -0,0 +1,900 @@
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "parser.h"
+#include "vars.h"
+
+// Lexer
+
+static int is_blank(char c) {
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static int is_operator(char c) {
+	return c == '|' || c == '&' || c == ';' || c == '<' || c == '>';
+}
+
+// Operators, longest first so "<<<" is not read as "<<" then "<"
+static const struct {
+	const char* text;
+	enum token_type type;
+} operators[] = {
+	{"<<<", TOKEN_TLESS}, {"<<-", TOKEN_DLESSDASH}, {"&>>", TOKEN_ANDDGREAT},
+	{"||", TOKEN_OR}, {"&&", TOKEN_AND}, {"<<", TOKEN_DLESS}, {">>", TOKEN_DGREAT},
+	{"<&", TOKEN_LESSAND}, {">&", TOKEN_GREATAND}, {"&>", TOKEN_ANDGREAT}, {">|", TOKEN_GREAT},
+	{"|", TOKEN_PIPE}, {"&", TOKEN_AMP}, {";", TOKEN_SEMI}, {"<", TOKEN_LESS}, {">", TOKEN_GREAT},
+	{NULL, TOKEN_END}
+};
+
+/**
+ * @brief Recognize the operator starting at line[*pos] and step over it
+ */
+static enum token_type lex_operator(const char* line, size_t* pos) {
+	int i = 0;
+
+	while (strncmp(line + *pos, operators[i].text, strlen(operators[i].text)) != 0) i++;
+
+	*pos += strlen(operators[i].text);
+	return operators[i].type;
+}
+
+static int is_name_char(char c) {
+	return c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+}
+
+static int is_redirection(enum token_type type) {
+	return type == TOKEN_LESS || type == TOKEN_GREAT || type == TOKEN_DGREAT || type == TOKEN_LESSAND || type == TOKEN_GREATAND ||
+		type == TOKEN_ANDGREAT || type == TOKEN_ANDDGREAT || type == TOKEN_DLESS || type == TOKEN_DLESSDASH || type == TOKEN_TLESS;
+}
+
+/**
+ * @brief Measure the parameter expansion starting at the '$' at p
+ *
+ * Recognizes $NAME, ${NAME}, and the special parameters $? $$ $! $# $0-$9
+ * (also in braces).
+ *
+ * @param name - Receives where the name starts
+ * @param len - Receives the length of the name
+ * @return How many characters the expansion takes up, or 0 if this '$' is
+ * an ordinary character
+ */
+static size_t parameter(const char* p, const char** name, size_t* len) {
+	int braced = (p[1] == '{');
+	const char* start = p + 1 + braced;
+	size_t n = 0;
+
+	if (strchr("?$!#0123456789", *start) && *start != '\0') n = 1;
+
+	else if (var_valid_name(start, 1)) {
+		while (is_name_char(start[n])) n++;
+	}
+
+	if (n == 0 || (braced && start[n] != '}')) return 0;
+
+	*name = start;
+	*len = n;
+
+	return 1 + (size_t)braced + n + (size_t)braced;
+}
+
+/**
+ * @brief Find the parenthesis that closes the one at p, past quotes and nested pairs
+ *
+ * @return Just after it, or NULL if it is never closed
+ */
+static const char* skip_parens(const char* p) {
+	int depth = 0;
+
+	for (; *p; ++p) {
+		if (*p == '(') depth++;
+
+		else if (*p == ')') {
+			if (--depth == 0) return p + 1;
+		}
+
+		else if (*p == '\'') {
+			p = strchr(p + 1, '\'');
+
+			if (!p) return NULL;
+		}
+
+		else if (*p == '"') {
+			for (p++; *p != '"'; ++p) {
+				if (*p == '\0') return NULL;
+
+				if (*p == '\\' && p[1] != '\0') p++;
+			}
+		}
+
+		else if (*p == '\\' && p[1] != '\0') p++;
+	}
+
+	return NULL;
+}
+
+static int is_process_substitution(const char* p) {
+	return (p[0] == '<' || p[0] == '>') && p[1] == '(';
+}
+
+/**
+ * @brief Find the end of the word at line[r] without changing it
+ *
+ * @param expands - Set when the word has a '$' outside single quotes that
+ * starts an expansion (or a ${ that is not one, to be reported when it
+ * runs), a $(command), or starts with <(command) or >(command)
+ * @param quoted - Set when the word has quotes or escapes
+ * @return 0, -1 on an unterminated quote, -2 on an unclosed parenthesis
+ */
+static int scan_word(const char* line, size_t r, size_t* end, int* expands, int* quoted) {
+	const char* name;
+	size_t len;
+	int in_double = 0;
+
+	*expands = 0;
+
+	if (is_process_substitution(line + r)) {
+		const char* close = skip_parens(line + r + 1);
+
+		if (!close) return -2;
+
+		*expands = 1;
+		r = (size_t)(close - line);
+	}
+
+	while (line[r] != '\0' && (in_double || (!is_blank(line[r]) && !is_operator(line[r])))) {
+		char c = line[r];
+
+		if (c == '\'' && !in_double) {
+			const char* close = strchr(line + r + 1, '\'');
+
+			if (!close) return -1;
+
+			*quoted = 1;
+			r = (size_t)(close - line) + 1;
+			continue;
+		}
+
+		if (c == '"') {
+			*quoted = 1;
+			in_double = !in_double;
+		}
+
+		else if (c == '\\') {
+			*quoted = 1;
+
+			if (line[r + 1] != '\0') r++;
+		}
+
+		else if (c == '$' && line[r + 1] == '(') {
+			const char* close = skip_parens(line + r + 1);
+
+			if (!close) return -2;
+
+			*expands = 1;
+			r = (size_t)(close - line);
+			continue;
+		}
+
+		else if (c == '$' && (line[r + 1] == '{' || parameter(line + r, &name, &len) > 0)) *expands = 1;
+
+		r++;
+	}
+
+	if (in_double) return -1;
+
+	*end = r;
+	return 0;
+}
+
+static void set_token(struct token* tok, enum token_type type, char* text, int fd) {
+	tok->type = type;
+	tok->text = text;
+	tok->fd = fd;
+	tok->quoted = 0;
+	tok->raw = 0;
+	tok->assignment = 0;
+}
+
+int lex_line(char* line, struct arena* a, struct token** tokens) {
+	// Every token but TOKEN_END uses up at least one character
+	size_t len = strlen(line);
+	struct token* out = arena_alloc(a, (len + 1) * sizeof(struct token));
+	size_t n = 0;
+	size_t r = 0; // Read position
+	// Only then can a word need expanding
+	int has_expansion = memchr(line, '$', len) != NULL || strstr(line, "<(") != NULL || strstr(line, ">(") != NULL;
+
+	if (!out) {
+		perror("dragonshell");
+		return -1;
+	}
+
+	while (1) {
+		while (is_blank(line[r])) r++;
+
+		if (line[r] == '\0' || line[r] == '#') break;
+
+		if (is_operator(line[r]) && !(has_expansion && is_process_substitution(line + r))) {
+			enum token_type type = lex_operator(line, &r);
+
+			set_token(&out[n++], type, NULL, -1);
+			continue;
+		}
+
+		/* A word: quotes and escapes are removed by copying the characters down
+		to the write position w, which never gets ahead of r */
+		size_t start = r, w = r;
+		int quoted = 0, raw = 0;
+
+		// NAME=...; a quote before the = makes it an ordinary word
+		size_t name_len = 0;
+
+		while (is_name_char(line[r + name_len])) name_len++;
+
+		int assignment = line[r + name_len] == '=' && var_valid_name(line + r, name_len);
+
+		/* A word with something to expand keeps its quotes and is left for
+		expand_argv, which removes them when the command runs */
+		if (has_expansion) {
+			size_t end;
+			int rc = scan_word(line, r, &end, &raw, &quoted);
+
+			if (rc < 0) {
+				fprintf(stderr, "dragonshell: syntax error: %s\n", rc == -1 ? "unterminated quote" : "missing `)'");
+				return -1;
+			}
+
+			if (raw) r = w = end;
+		}
+
+		while (line[r] != '\0' && !is_blank(line[r]) && !is_operator(line[r])) {
+			char c = line[r];
+
+			if (c == '\'') {
+				char* close = strchr(line + r + 1, '\'');
+
+				if (!close) {
+					fprintf(stderr, "dragonshell: syntax error: unterminated quote\n");
+					return -1;
+				}
+
+				size_t inner = (size_t)(close - (line + r + 1));
+				quoted = 1;
+				memmove(line + w, line + r + 1, inner);
+
+				w += inner;
+				r += inner + 2;
+			}
+
+			else if (c == '"') {
+				r++;
+				quoted = 1;
+
+				while (line[r] != '"') {
+					if (line[r] == '\0') {
+						fprintf(stderr, "dragonshell: syntax error: unterminated quote\n");
+						return -1;
+					}
+
+					// Inside double quotes a backslash only escapes these
+					if (line[r] == '\\' && line[r + 1] != '\0' && strchr("\\\"$`", line[r + 1])) r++;
+
+					line[w++] = line[r++];
+				}
+
+				r++;
+			}
+
+			else if (c == '\\') {
+				quoted = 1;
+
+				if (line[r + 1] != '\0') line[w++] = line[r + 1];
+
+				r += (line[r + 1] != '\0') ? 2 : 1;
+			}
+
+			else line[w++] = line[r++];
+		}
+
+		/* The word ends at a blank, an operator or the end of the line. When
+		nothing was removed, its '\0' lands on that character, so read the
+		operator first */
+		int has_operator = is_operator(line[r]);
+		enum token_type op = has_operator ? lex_operator(line, &r) : TOKEN_END;
+
+		if (line[r] != '\0' && !has_operator) r++; // Step over the blank
+
+		line[w] = '\0';
+
+		// 2>file: an unquoted number glued to a redirection names its descriptor
+		if (has_operator && is_redirection(op) && op != TOKEN_ANDGREAT && op != TOKEN_ANDDGREAT && !quoted &&
+			strspn(line + start, "0123456789") == w - start && w - start < 4) {
+			set_token(&out[n++], op, NULL, atoi(line + start));
+			continue;
+		}
+
+		set_token(&out[n], TOKEN_WORD, line + start, -1);
+		out[n].quoted = quoted;
+		out[n].raw = raw;
+		out[n++].assignment = assignment;
+
+		if (has_operator) set_token(&out[n++], op, NULL, -1);
+	}
+
+	set_token(&out[n], TOKEN_END, NULL, -1);
+
+	*tokens = out;
+	return 0;
+}
+
+// Parser (recursive descent, everything allocated from the arena)
+
+struct parser {
+	struct token* tokens;
+	int pos;
+	struct arena* a;
+	int error;
+
+	struct redirection** heredoc_tail; // Where the next here-document is linked in
+};
+
+static const char* token_name(enum token_type type) {
+	if (type == TOKEN_WORD) return "word";
+	if (type == TOKEN_END) return "newline";
+
+	for (int i = 0; operators[i].text != NULL; ++i)
+		if (operators[i].type == type) return operators[i].text;
+
+	return "word";
+}
+
+static void syntax_error(struct parser* p) {
+	if (!p->error)
+		fprintf(stderr, "dragonshell: syntax error near unexpected token `%s'\n", token_name(p->tokens[p->pos].type));
+
+	p->error = 1;
+}
+
+static enum token_type peek(struct parser* p) {
+	return p->tokens[p->pos].type;
+}
+
+// Tokens that end a simple command
+static int ends_command(enum token_type type) {
+	return type != TOKEN_WORD && !is_redirection(type);
+}
+
+static struct node* new_node(struct parser* p, enum node_type type, struct node* left, struct node* right) {
+	struct node* node = arena_alloc(p->a, sizeof(struct node));
+
+	if (!node) {
+		p->error = 1;
+		return NULL;
+	}
+
+	node->type = type;
+	node->left = left;
+	node->right = right;
+	node->commands = NULL;
+	node->n_commands = 0;
+	node->timed = 0;
+
+	return node;
+}
+
+static struct redirection* add_redirection(struct parser* p, struct redirection*** tail, enum redirection_type type, int fd, char* target, int raw) {
+	struct redirection* redir = arena_alloc(p->a, sizeof(struct redirection));
+
+	if (!redir) {
+		p->error = 1;
+		return NULL;
+	}
+
+	redir->type = type;
+	redir->fd = fd;
+	redir->target = target;
+	redir->raw = raw;
+	redir->delimiter = NULL;
+	redir->strip_tabs = 0;
+	redir->quoted = 0;
+	redir->next = NULL;
+	redir->next_heredoc = NULL;
+
+	**tail = redir;
+	*tail = &redir->next;
+
+	return redir;
+}
+
+static int parse_command(struct parser* p, struct command* cmd) {
+	// Count the words first so argv is allocated exactly once
+	int words = 0, assignments = 0, raw = 0;
+
+	for (int i = p->pos; !ends_command(p->tokens[i].type); ++i) {
+		if (is_redirection(p->tokens[i].type)) {
+			if (p->tokens[i + 1].type == TOKEN_WORD) i++;
+			continue;
+		}
+
+		if (words == assignments && p->tokens[i].assignment) assignments++;
+
+		words++;
+		raw |= p->tokens[i].raw;
+	}
+
+	if (words == 0) {
+		syntax_error(p);
+		return -1;
+	}
+
+	cmd->argv = arena_alloc(p->a, (size_t)(words - assignments + 1) * sizeof(char*));
+	cmd->argc = 0;
+	cmd->raw = NULL;
+	cmd->assignments = assignments ? arena_alloc(p->a, (size_t)assignments * sizeof(char*)) : NULL;
+	cmd->n_assignments = 0;
+	cmd->raw_assignments = NULL;
+	cmd->redirs = NULL;
+	cmd->pass_fds = NULL;
+	cmd->n_pass_fds = 0;
+
+	if (raw) {
+		// One mask for both: assignments first, then argv
+		cmd->raw_assignments = arena_alloc(p->a, (size_t)words);
+
+		if (cmd->raw_assignments) cmd->raw = cmd->raw_assignments + assignments;
+	}
+
+	if (!cmd->argv || (assignments && !cmd->assignments) || (raw && !cmd->raw)) {
+		p->error = 1;
+		return -1;
+	}
+
+	struct redirection** tail = &cmd->redirs;
+
+	while (!ends_command(peek(p))) {
+		struct token* tok = &p->tokens[p->pos++];
+
+		if (tok->type == TOKEN_WORD) {
+			if (cmd->n_assignments < assignments) {
+				if (raw) cmd->raw_assignments[cmd->n_assignments] = (unsigned char)tok->raw;
+
+				cmd->assignments[cmd->n_assignments++] = tok->text;
+				continue;
+			}
+
+			if (raw) cmd->raw[cmd->argc] = (unsigned char)tok->raw;
+
+			cmd->argv[cmd->argc++] = tok->text;
+			continue;
+		}
+
+		if (peek(p) != TOKEN_WORD) {
+			syntax_error(p);
+			return -1;
+		}
+
+		struct token* word = &p->tokens[p->pos++];
+		char* target = word->text;
+		int fd = tok->fd;
+		struct redirection* redir = NULL;
+
+		switch (tok->type) {
+			case TOKEN_LESS:
+				redir = add_redirection(p, &tail, REDIRECT_IN, fd >= 0 ? fd : 0, target, word->raw);
+				break;
+
+			case TOKEN_GREAT:
+				redir = add_redirection(p, &tail, REDIRECT_OUT, fd >= 0 ? fd : 1, target, word->raw);
+				break;
+
+			case TOKEN_DGREAT:
+				redir = add_redirection(p, &tail, REDIRECT_APPEND, fd >= 0 ? fd : 1, target, word->raw);
+				break;
+
+			case TOKEN_LESSAND:
+				redir = add_redirection(p, &tail, REDIRECT_DUP, fd >= 0 ? fd : 0, target, word->raw);
+				break;
+
+			case TOKEN_TLESS:
+				redir = add_redirection(p, &tail, REDIRECT_STRING, fd >= 0 ? fd : 0, target, word->raw);
+				break;
+
+			case TOKEN_DLESS:
+			case TOKEN_DLESSDASH:
+				redir = add_redirection(p, &tail, REDIRECT_HEREDOC, fd >= 0 ? fd : 0, NULL, 0);
+
+				// The delimiter is never expanded, only unquoted; quoting it turns expansion of the body off
+				if (redir && word->raw) target = expand_word(target, p->a, NULL);
+
+				if (redir && !target) redir = NULL;
+
+				if (redir) {
+					redir->delimiter = target;
+					redir->strip_tabs = (tok->type == TOKEN_DLESSDASH);
+					redir->quoted = word->quoted;
+
+					*p->heredoc_tail = redir;
+					p->heredoc_tail = &redir->next_heredoc;
+				}
+
+				break;
+
+			case TOKEN_GREATAND:
+				// >&2 duplicates; >& file (no number given) is &> file
+				if (fd >= 0 || (!word->raw && (strcmp(target, "-") == 0 || strspn(target, "0123456789") == strlen(target)))) {
+					redir = add_redirection(p, &tail, REDIRECT_DUP, fd >= 0 ? fd : 1, target, word->raw);
+					break;
+				}
+
+				/* fall through */
+
+			default:
+				// &> file and &>> file: stdout to the file, then stderr to stdout
+				redir = add_redirection(p, &tail, tok->type == TOKEN_ANDDGREAT ? REDIRECT_APPEND : REDIRECT_OUT, 1, target, word->raw);
+
+				if (redir) redir = add_redirection(p, &tail, REDIRECT_DUP, 2, "1", 0);
+		}
+
+		if (!redir) return -1;
+	}
+
+	cmd->argv[cmd->argc] = NULL;
+	return 0;
+}
+
+static struct node* parse_pipeline(struct parser* p) {
+	// 'time' is a keyword only where a pipeline starts and something follows it
+	int timed = peek(p) == TOKEN_WORD && strcmp(p->tokens[p->pos].text, "time") == 0 && !ends_command(p->tokens[p->pos + 1].type);
+
+	if (timed) p->pos++;
+
+	// Count the stages up to the end of the pipeline
+	int stages = 1;
+
+	for (int i = p->pos; p->tokens[i].type == TOKEN_WORD || is_redirection(p->tokens[i].type) || p->tokens[i].type == TOKEN_PIPE; ++i)
+		if (p->tokens[i].type == TOKEN_PIPE) stages++;
+
+	struct node* node = new_node(p, NODE_PIPELINE, NULL, NULL);
+
+	if (!node) return NULL;
+
+	node->timed = timed;
+	node->commands = arena_alloc(p->a, (size_t)stages * sizeof(struct command));
+
+	if (!node->commands) {
+		p->error = 1;
+		return NULL;
+	}
+
+	while (1) {
+		if (parse_command(p, &node->commands[node->n_commands]) < 0) return NULL;
+
+		node->n_commands++;
+
+		if (peek(p) != TOKEN_PIPE) break;
+
+		p->pos++;
+	}
+
+	return node;
+}
+
+static struct node* parse_and_or(struct parser* p) {
+	struct node* left = parse_pipeline(p);
+
+	while (left && (peek(p) == TOKEN_AND || peek(p) == TOKEN_OR)) {
+		enum node_type type = (peek(p) == TOKEN_AND) ? NODE_AND : NODE_OR;
+
+		p->pos++;
+
+		struct node* right = parse_pipeline(p);
+
+		left = right ? new_node(p, type, left, right) : NULL;
+	}
+
+	return left;
+}
+
+static struct node* parse_list(struct parser* p) {
+	struct node* list = NULL;
+
+	while (peek(p) != TOKEN_END) {
+		struct node* item = parse_and_or(p);
+
+		if (!item) return NULL;
+
+		if (peek(p) == TOKEN_AMP) item = new_node(p, NODE_BACKGROUND, item, NULL);
+
+		if (peek(p) == TOKEN_AMP || peek(p) == TOKEN_SEMI) p->pos++;
+
+		else if (peek(p) != TOKEN_END) {
+			syntax_error(p);
+			return NULL;
+		}
+
+		list = list ? new_node(p, NODE_SEQUENCE, list, item) : item;
+
+		if (!list) return NULL;
+	}
+
+	return list;
+}
+
+struct node* parse_tokens(struct token* tokens, struct arena* a, struct redirection** heredocs, int* error) {
+	struct parser p = {tokens, 0, a, 0, heredocs};
+
+	*heredocs = NULL;
+
+	struct node* root = parse_list(&p);
+
+	*error = p.error;
+
+	return p.error ? NULL : root;
+}
+
+// Expansion (when a command runs, of the words the lexer left raw)
+
+enum expand_mode {
+	EXPAND_FIELDS,  // Unquoted substitutions are split into fields (argv)
+	EXPAND_WORD,    // One word whatever it expands to
+	EXPAND_HEREDOC  // Quotes are ordinary characters
+};
+
+struct expansion {
+	struct arena* a;
+	const struct expand_hooks* hooks;
+	enum expand_mode mode;
+
+	char* buf; // Field being built
+	size_t len;
+	size_t cap;
+	int started; // The field exists even if empty, since quotes were seen
+
+	char** fields; // Finished fields
+	int n_fields;
+	int cap_fields;
+
+	int error;
+};
+
+static void put(struct expansion* e, const char* str, size_t len) {
+	if (e->len + len + 1 > e->cap) {
+		size_t cap = e->cap ? e->cap : 64;
+
+		while (e->len + len + 1 > cap) cap *= 2;
+
+		char* buf = arena_alloc(e->a, cap);
+
+		if (!buf) {
+			perror("dragonshell");
+			e->error = 1;
+			return;
+		}
+
+		if (e->len) memcpy(buf, e->buf, e->len);
+
+		e->buf = buf;
+		e->cap = cap;
+	}
+
+	memcpy(e->buf + e->len, str, len);
+	e->len += len;
+}
+
+static void end_field(struct expansion* e) {
+	if (e->n_fields == e->cap_fields) {
+		int cap = e->cap_fields ? e->cap_fields * 2 : 8;
+		char** fields = arena_alloc(e->a, (size_t)(cap + 1) * sizeof(char*));
+
+		if (!fields) {
+			perror("dragonshell");
+			e->error = 1;
+			return;
+		}
+
+		if (e->n_fields) memcpy(fields, e->fields, (size_t)e->n_fields * sizeof(char*));
+
+		e->fields = fields;
+		e->cap_fields = cap;
+	}
+
+	char* field = arena_strndup(e->a, e->len ? e->buf : "", e->len);
+
+	if (!field) {
+		perror("dragonshell");
+		e->error = 1;
+	}
+
+	e->fields[e->n_fields++] = field;
+	e->len = 0;
+	e->started = 0;
+}
+
+/**
+ * @brief Add a substituted value to the field, split at blanks where that applies
+ */
+static void put_value(struct expansion* e, const char* value, int in_double) {
+	if (in_double || e->mode != EXPAND_FIELDS) {
+		put(e, value, strlen(value));
+		return;
+	}
+
+	// Split at blanks, which never make an empty field
+	while (*value) {
+		size_t run = strcspn(value, " \t\n");
+
+		put(e, value, run);
+		value += run;
+
+		if (*value == '\0') break;
+
+		if (e->len > 0 || e->started) end_field(e);
+
+		value += strspn(value, " \t\n");
+	}
+}
+
+/**
+ * @brief Substitute the parameter or $(command) at the '$' at p
+ *
+ * @return Characters of the word used up
+ */
+static size_t substitute(struct expansion* e, const char* p, int in_double) {
+	const char* name;
+	size_t len;
+
+	if (p[1] == '(' && e->hooks) {
+		const char* close = skip_parens(p + 1);
+
+		// The lexer only lets closed ones through, but a here-document body is not lexed
+		if (!close) {
+			put(e, p, 1);
+			return 1;
+		}
+
+		char* output = e->hooks->command(p + 2, (size_t)(close - p - 3));
+
+		if (!output) e->error = 1;
+		else put_value(e, output, in_double);
+
+		return (size_t)(close - p);
+	}
+
+	size_t used = parameter(p, &name, &len);
+
+	if (used == 0 && p[1] == '{') {
+		const char* close = strchr(p, '}');
+
+		fprintf(stderr, "dragonshell: %.*s: bad substitution\n", close ? (int)(close - p + 1) : (int)strlen(p), p);
+		e->error = 1;
+		return strlen(p);
+	}
+
+	if (used == 0 || !e->hooks) {
+		put(e, p, 1);
+		return 1;
+	}
+
+	const char* value = e->hooks->lookup(name, len);
+
+	put_value(e, value ? value : "", in_double);
+
+	return used;
+}
+
+static void expand_text(struct expansion* e, const char* word) {
+	int in_double = 0;
+	const char* p = word;
+
+	// <(command) and >(command) are a path, never split
+	if (e->hooks && e->mode != EXPAND_HEREDOC && is_process_substitution(word)) {
+		const char* close = skip_parens(word + 1);
+
+		if (close) {
+			char* path = e->hooks->process(word + 2, (size_t)(close - word - 3), word[0] == '>');
+
+			if (!path) e->error = 1;
+			else put(e, path, strlen(path));
+
+			p = close;
+		}
+	}
+
+	while (*p && !e->error) {
+		if (e->mode == EXPAND_HEREDOC) {
+			if (*p == '\\' && p[1] != '\0' && strchr("\\$`", p[1])) {
+				put(e, p + 1, 1);
+				p += 2;
+			}
+
+			else if (*p == '$') p += substitute(e, p, 1);
+
+			else put(e, p++, 1);
+
+			continue;
+		}
+
+		if (*p == '\'' && !in_double) {
+			const char* close = strchr(p + 1, '\'');
+			size_t inner = close ? (size_t)(close - p - 1) : strlen(p + 1);
+
+			e->started = 1;
+			put(e, p + 1, inner);
+			p += inner + (close ? 2 : 1);
+		}
+
+		else if (*p == '"') {
+			e->started = 1;
+			in_double = !in_double;
+			p++;
+		}
+
+		else if (*p == '\\') {
+			// Inside double quotes a backslash only escapes these
+			if (in_double && (p[1] == '\0' || !strchr("\\\"$`", p[1]))) put(e, p++, 1);
+
+			else if (p[1] != '\0') {
+				e->started = 1;
+				put(e, p + 1, 1);
+				p += 2;
+			}
+
+			else p++;
+		}
+
+		else if (*p == '$') p += substitute(e, p, in_double);
+
+		else put(e, p++, 1);
+	}
+}
+
+char** expand_argv(char** words, const unsigned char* raw, int* count, struct arena* a, const struct expand_hooks* hooks) {
+	struct expansion e = {a, hooks, EXPAND_FIELDS, NULL, 0, 0, 0, NULL, 0, 0, 0};
+
+	for (int i = 0; i < *count && !e.error; ++i) {
+		if (raw && raw[i]) {
+			expand_text(&e, words[i]);
+
+			if (e.len > 0 || e.started) end_field(&e);
+		}
+
+		else {
+			put(&e, words[i], strlen(words[i]));
+			end_field(&e);
+		}
+	}
+
+	// No words at all still needs a terminated array
+	if (!e.error && e.cap_fields == 0 && !(e.fields = arena_alloc(a, sizeof(char*)))) perror("dragonshell");
+
+	if (e.error || !e.fields) return NULL;
+
+	e.fields[e.n_fields] = NULL;
+	*count = e.n_fields;
+
+	return e.fields;
+}
+
+static char* expand_one(const char* text, struct arena* a, const struct expand_hooks* hooks, enum expand_mode mode) {
+	struct expansion e = {a, hooks, mode, NULL, 0, 0, 0, NULL, 0, 0, 0};
+
+	expand_text(&e, text);
+
+	if (e.error) return NULL;
+
+	char* word = arena_strndup(a, e.len ? e.buf : "", e.len);
+
+	if (!word) perror("dragonshell");
+
+	return word;
+}
+
+char* expand_word(const char* word, struct arena* a, const struct expand_hooks* hooks) {
+	return expand_one(word, a, hooks, EXPAND_WORD);
+}
+
+char* expand_heredoc(const char* body, struct arena* a, const struct expand_hooks* hooks) {
+	return expand_one(body, a, hooks, EXPAND_HEREDOC);
+}
@@ -0,0 +1,183 @@
+#ifndef DRAGONSHELL_PARSER_H
+#define DRAGONSHELL_PARSER_H
+
+#include "arena.h"
+
+// Lexer and parser: one pass over the input line, producing a small AST in the arena
+
+enum token_type {
+	TOKEN_WORD,
+	TOKEN_PIPE,  // |
+	TOKEN_AND,   // &&
+	TOKEN_OR,    // ||
+	TOKEN_SEMI,  // ;
+	TOKEN_AMP,   // &
+	TOKEN_LESS,      // <
+	TOKEN_GREAT,     // > (and >|)
+	TOKEN_DGREAT,    // >>
+	TOKEN_LESSAND,   // <&
+	TOKEN_GREATAND,  // >&
+	TOKEN_ANDGREAT,  // &>
+	TOKEN_ANDDGREAT, // &>>
+	TOKEN_DLESS,     // <<
+	TOKEN_DLESSDASH, // <<-
+	TOKEN_TLESS,     // <<<
+	TOKEN_END
+};
+
+struct token {
+	enum token_type type;
+	char* text; // TOKEN_WORD only: the unquoted word, inside the input line
+	int fd;     // Redirections: the descriptor number written right before them (2>), or -1
+
+	int quoted;     // TOKEN_WORD: had quotes or escapes
+	int raw;        // TOKEN_WORD: has a $ to expand, so text still has its quotes
+	int assignment; // TOKEN_WORD: starts with NAME=
+};
+
+enum redirection_type {
+	REDIRECT_IN,      // [n]< file
+	REDIRECT_OUT,     // [n]> file
+	REDIRECT_APPEND,  // [n]>> file
+	REDIRECT_DUP,     // [n]>&m or [n]<&m; m of "-" closes n
+	REDIRECT_STRING,  // [n]<<< word
+	REDIRECT_HEREDOC  // [n]<<DELIM, [n]<<-DELIM
+};
+
+struct redirection {
+	enum redirection_type type;
+	int fd;       // Descriptor being redirected
+	char* target; // File, descriptor number, here-string, or here-document body once read
+	int raw;      // target still has quotes and $ to expand (expand_word)
+
+	char* delimiter; // REDIRECT_HEREDOC: line that ends the body
+	int strip_tabs;  // REDIRECT_HEREDOC: <<- removes leading tabs from the body
+	int quoted;      // REDIRECT_HEREDOC: the delimiter was quoted, so the body is not expanded
+
+	struct redirection* next; // In the order they were written
+	struct redirection* next_heredoc; // Here-documents of the line, in the order their bodies follow it
+};
+
+// A simple command: words plus redirections
+struct command {
+	char** argv; // NULL terminated
+	int argc;
+	unsigned char* raw; // raw[i]: argv[i] still has quotes and $ to expand (NULL when no word does)
+
+	char** assignments; // NAME=value words written before the command name
+	int n_assignments;
+	unsigned char* raw_assignments; // Like raw, for assignments
+
+	struct redirection* redirs;
+
+	int* pass_fds; // Shell's ends of the command's <(...) and >(...) pipes, set by expansion
+	int n_pass_fds;
+};
+
+enum node_type {
+	NODE_PIPELINE,   // commands[0] | commands[1] | ... (a simple command is a 1-stage pipeline)
+	NODE_AND,        // left && right
+	NODE_OR,         // left || right
+	NODE_SEQUENCE,   // left ; right
+	NODE_BACKGROUND  // left &
+};
+
+struct node {
+	enum node_type type;
+
+	struct node* left;
+	struct node* right;
+
+	struct command* commands; // NODE_PIPELINE only
+	int n_commands;
+	int timed; // NODE_PIPELINE: preceded by the time keyword
+};
+
+/**
+ * @brief Split a line into tokens, removing quotes and escapes in place
+ *
+ * Words are unquoted and terminated inside the line itself, so no word is
+ * copied. Handles '...', "..." (with \ escapes for \ " $ `), \ escapes and
+ * # comments. An unquoted number right before a redirection operator (2>)
+ * becomes that operator's descriptor instead of a word. 'time' is an
+ * ordinary word here; the parser decides when it is the keyword.
+ *
+ * A word with a $ expansion, $(command) or <(command) in it cannot be
+ * finished until the command runs, since the variables it names may change
+ * before then (X=1; echo $X). It is only terminated, keeps its quotes and is
+ * flagged raw for expand_argv. Blanks and operators inside the parentheses
+ * do not end it.
+ *
+ * @param line - The input line (modified in place)
+ * @param a - Arena for the token array
+ * @param tokens - Receives the tokens, ending with TOKEN_END
+ * @return 0 on success, -1 (with a message printed) on an unterminated quote
+ */
+int lex_line(char* line, struct arena* a, struct token** tokens);
+
+/**
+ * @brief Build the AST of a tokenized line
+ *
+ * Grammar:
+ *   list     := and_or (( ';' | '&' ) and_or)* [ ';' | '&' ]
+ *   and_or   := pipeline (( '&&' | '||' ) pipeline)*
+ *   pipeline := [ 'time' ] command ( '|' command )*
+ *   command  := ( WORD | redirection WORD )+
+ *
+ * Words of the form NAME=value before the first other word of a command are
+ * its assignments rather than part of argv (a command may be only those).
+ * &> file and &>> file become > file (or >> file) followed by 2>&1, as does
+ * >& file when file is not a descriptor number. Here-document bodies are not
+ * part of the line; the caller reads them into target.
+ *
+ * @param heredocs - Receives the line's here-documents (NULL if none)
+ * @return The root node, NULL for an empty line or (after printing a
+ * message) a syntax error; *error tells the two apart
+ */
+struct node* parse_tokens(struct token* tokens, struct arena* a, struct redirection** heredocs, int* error);
+
+// What expansion asks the shell for; the text passed in is not terminated
+struct expand_hooks {
+	// Value of a parameter (?, $, !, #, 0-9 or a variable name), or NULL if it is unset
+	const char* (*lookup)(const char* name, size_t len);
+
+	// Output of $(text) without its trailing newlines, or NULL (with a message printed)
+	char* (*command)(const char* text, size_t len);
+
+	// A /dev/fd path to read <(text) from (output 0) or write >(text) to (output 1), or NULL
+	char* (*process)(const char* text, size_t len, int output);
+};
+
+/**
+ * @brief Expand the words of a command right before it runs
+ *
+ * Raw words get their parameters and $(command) substitutions replaced and
+ * quotes removed; a substitution outside double quotes is split at blanks,
+ * so one word may become several or (when it is empty) none. A word that
+ * starts with <( or >( becomes a /dev/fd path. Other words are kept as they
+ * are.
+ *
+ * @param words - The words, raw[i] telling which need expanding (raw may be NULL)
+ * @param count - Number of words in, receives the number of words out
+ * @return NULL terminated words in the arena, or NULL (after printing a
+ * message) on a bad ${...} or when out of memory
+ */
+char** expand_argv(char** words, const unsigned char* raw, int* count, struct arena* a, const struct expand_hooks* hooks);
+
+/**
+ * @brief Expand a raw word that must stay one word (redirection target, assignment)
+ *
+ * @param hooks - NULL only removes quotes, leaving every $ as it is
+ * @return The word in the arena, or NULL (after printing a message) on error
+ */
+char* expand_word(const char* word, struct arena* a, const struct expand_hooks* hooks);
+
+/**
+ * @brief Expand the body of a here-document whose delimiter was not quoted
+ *
+ * Parameters and $(command) are substituted and \ only escapes $, ` and \;
+ * quotes are ordinary characters.
+ */
+char* expand_heredoc(const char* body, struct arena* a, const struct expand_hooks* hooks);
+
+#endif
@@ -0,0 +1,408 @@
+#define _XOPEN_SOURCE 700
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "quota.h"
+#include "vars.h"
+
+#define CPU_PERIOD_US 100000 // cpu.max period; the quota is the given percentage of it
+
+// Resource limits
+
+struct limit_kind {
+	char option;
+	int resource;
+	const char* name;
+	const char* unit; // What ulimit counts in, or NULL for a plain number
+	rlim_t scale;     // Bytes (or units) per counted unit
+};
+
+static const struct limit_kind kinds[] = {
+	{'t', RLIMIT_CPU, "cpu time", "seconds", 1},
+	{'v', RLIMIT_AS, "virtual memory", "kbytes", 1024},
+	{'n', RLIMIT_NOFILE, "open files", NULL, 1}
+};
+
+#define N_KINDS (int)(sizeof(kinds) / sizeof(kinds[0]))
+
+// Limits set with ulimit, handed to the spawn engine as they are
+static struct spawn_limit job_limits[N_KINDS];
+static int n_job_limits = 0;
+
+/**
+ * @brief The limit commands get: the one set with ulimit, or else the shell's own
+ */
+static struct rlimit current_limit(int resource) {
+	struct rlimit value;
+
+	for (int i = 0; i < n_job_limits; ++i)
+		if (job_limits[i].resource == resource) return job_limits[i].value;
+
+	if (getrlimit(resource, &value) < 0) value.rlim_cur = value.rlim_max = RLIM_INFINITY;
+
+	return value;
+}
+
+static void print_limit(const struct limit_kind* kind, int hard) {
+	struct rlimit value = current_limit(kind->resource);
+	rlim_t limit = hard ? value.rlim_max : value.rlim_cur;
+
+	if (limit == RLIM_INFINITY) printf("unlimited\n");
+
+	else printf("%llu\n", (unsigned long long)(limit / kind->scale));
+}
+
+int ulimit_command(char** args) {
+	const struct limit_kind* kind = &kinds[1];
+	int soft = 0, hard = 0, all = 0;
+	int i = 1;
+
+	for (; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0'; ++i) {
+		for (const char* opt = args[i] + 1; *opt; ++opt) {
+			int k = 0;
+
+			while (k < N_KINDS && kinds[k].option != *opt) k++;
+
+			if (k < N_KINDS) kind = &kinds[k];
+
+			else if (*opt == 'S') soft = 1;
+
+			else if (*opt == 'H') hard = 1;
+
+			else if (*opt == 'a') all = 1;
+
+			else {
+				fprintf(stderr, "dragonshell: ulimit: -%c: invalid option\n", *opt);
+				return 1;
+			}
+		}
+	}
+
+	if (all) {
+		for (int k = 0; k < N_KINDS; ++k) {
+			char flag[32];
+
+			snprintf(flag, sizeof(flag), "(%s%s-%c)", kinds[k].unit ? kinds[k].unit : "", kinds[k].unit ? ", " : "", kinds[k].option);
+			printf("%-16s %16s ", kinds[k].name, flag);
+			print_limit(&kinds[k], hard && !soft);
+		}
+
+		return 0;
+	}
+
+	if (args[i] == NULL) {
+		print_limit(kind, hard && !soft);
+		return 0;
+	}
+
+	rlim_t limit = RLIM_INFINITY;
+
+	if (strcmp(args[i], "unlimited") != 0) {
+		char* end;
+		unsigned long long n = strtoull(args[i], &end, 10);
+
+		if (args[i][0] < '0' || args[i][0] > '9' || *end != '\0' || n > (unsigned long long)(RLIM_INFINITY - 1) / kind->scale) {
+			fprintf(stderr, "dragonshell: ulimit: %s: invalid number\n", args[i]);
+			return 1;
+		}
+
+		limit = (rlim_t)n * kind->scale;
+	}
+
+	if (!soft && !hard) soft = hard = 1;
+
+	struct rlimit value = current_limit(kind->resource);
+	struct rlimit shell_value;
+
+	if (soft) value.rlim_cur = limit;
+	if (hard) value.rlim_max = limit;
+
+	// RLIM_INFINITY is the largest value, so plain comparisons hold
+	if (value.rlim_cur > value.rlim_max) {
+		fprintf(stderr, "dragonshell: ulimit: %s: soft limit above hard limit\n", kind->name);
+		return 1;
+	}
+
+	// Children could not raise it either, and would fail to start
+	if (getrlimit(kind->resource, &shell_value) == 0 && geteuid() != 0 && value.rlim_max > shell_value.rlim_max) {
+		fprintf(stderr, "dragonshell: ulimit: %s: cannot raise the hard limit\n", kind->name);
+		return 1;
+	}
+
+	int k = 0;
+
+	while (k < n_job_limits && job_limits[k].resource != kind->resource) k++;
+
+	if (k == n_job_limits) n_job_limits++;
+
+	job_limits[k].resource = kind->resource;
+	job_limits[k].value = value;
+
+	return 0;
+}
+
+// cgroup v2 caps
+
+static char* cgroup_dir = NULL;     // Parent of the job cgroups, NULL while caps are off
+static unsigned long long memory_max = 0; // Bytes, 0 for no cap
+static int cpu_percent = 0;         // Of one CPU, 0 for no cap
+
+static char** job_cgroups = NULL;   // Cgroups made for jobs and not removed yet
+static int n_job_cgroups = 0;
+static int cap_job_cgroups = 0;
+static unsigned long job_serial = 0;
+
+static int write_file(const char* dir, const char* name, const char* text) {
+	char path[PATH_MAX];
+
+	if (snprintf(path, sizeof(path), "%s/%s", dir, name) >= (int)sizeof(path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	int fd = open(path, O_WRONLY | O_CLOEXEC);
+
+	if (fd < 0) return -1;
+
+	ssize_t n = write(fd, text, strlen(text));
+	int saved = errno;
+
+	close(fd);
+	errno = saved;
+
+	return n < 0 ? -1 : 0;
+}
+
+/**
+ * @brief Remove the job cgroups whose processes have all exited
+ */
+static void prune_cgroups() {
+	for (int i = 0; i < n_job_cgroups; ) {
+		if (rmdir(job_cgroups[i]) == 0 || errno == ENOENT) {
+			free(job_cgroups[i]);
+			job_cgroups[i] = job_cgroups[--n_job_cgroups];
+			continue;
+		}
+
+		i++;
+	}
+}
+
+int quota_job_cgroup(int* fd) {
+	*fd = -1;
+
+	if (!cgroup_dir) return 0;
+
+	prune_cgroups();
+
+	if (n_job_cgroups == cap_job_cgroups) {
+		int cap = cap_job_cgroups ? cap_job_cgroups * 2 : 16;
+		char** bigger = realloc(job_cgroups, (size_t)cap * sizeof(char*));
+
+		if (!bigger) {
+			perror("dragonshell: cgroup");
+			return -1;
+		}
+
+		job_cgroups = bigger;
+		cap_job_cgroups = cap;
+	}
+
+	char path[PATH_MAX];
+	char value[64];
+
+	snprintf(path, sizeof(path), "%s/dragonshell-%d-%lu", cgroup_dir, (int)getpid(), ++job_serial);
+
+	if (mkdir(path, 0755) < 0) {
+		fprintf(stderr, "dragonshell: cgroup: %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	int failed = 0;
+
+	if (memory_max > 0) {
+		snprintf(value, sizeof(value), "%llu", memory_max);
+		failed = write_file(path, "memory.max", value) < 0;
+	}
+
+	if (!failed && cpu_percent > 0) {
+		snprintf(value, sizeof(value), "%d %d", cpu_percent * (CPU_PERIOD_US / 100), CPU_PERIOD_US);
+		failed = write_file(path, "cpu.max", value) < 0;
+	}
+
+	if (!failed) {
+		char procs[PATH_MAX + 16];
+
+		snprintf(procs, sizeof(procs), "%s/cgroup.procs", path);
+		*fd = open(procs, O_WRONLY | O_CLOEXEC);
+		failed = *fd < 0;
+	}
+
+	if (failed) {
+		fprintf(stderr, "dragonshell: cgroup: %s: %s\n", path, strerror(errno));
+		rmdir(path);
+		return -1;
+	}
+
+	job_cgroups[n_job_cgroups] = strdup(path);
+
+	if (job_cgroups[n_job_cgroups]) n_job_cgroups++;
+
+	return 0;
+}
+
+void quota_apply(struct spawn_io* io, int cgroup_fd) {
+	io->limits = n_job_limits ? job_limits : NULL;
+	io->n_limits = n_job_limits;
+	io->cgroup_fd = cgroup_fd;
+}
+
+void quota_clear() {
+	prune_cgroups();
+
+	for (int i = 0; i < n_job_cgroups; ++i) free(job_cgroups[i]);
+
+	free(job_cgroups);
+	free(cgroup_dir);
+
+	job_cgroups = NULL;
+	n_job_cgroups = cap_job_cgroups = 0;
+	cgroup_dir = NULL;
+	n_job_limits = 0;
+}
+
+/**
+ * @brief Parse a byte count with an optional K, M or G suffix; "max" is 0 (no cap)
+ *
+ * @return 0, or -1 if it is not one
+ */
+static int parse_bytes(const char* text, unsigned long long* bytes) {
+	if (strcmp(text, "max") == 0) {
+		*bytes = 0;
+		return 0;
+	}
+
+	char* end;
+	unsigned long long n = strtoull(text, &end, 10);
+	int shift = 0;
+
+	if (text[0] < '0' || text[0] > '9') return -1;
+
+	if (*end == 'K' || *end == 'k') shift = 10;
+	else if (*end == 'M' || *end == 'm') shift = 20;
+	else if (*end == 'G' || *end == 'g') shift = 30;
+
+	if (shift) end++;
+
+	if (*end != '\0' || n == 0 || n > (~0ULL >> shift)) return -1;
+
+	*bytes = n << shift;
+	return 0;
+}
+
+int cgroup_command(char** args) {
+	if (args[1] == NULL) {
+		if (!cgroup_dir) {
+			printf("cgroup caps are off\n");
+			return 0;
+		}
+
+		printf("%s: memory.max ", cgroup_dir);
+
+		if (memory_max) printf("%llu", memory_max);
+		else printf("max");
+
+		if (cpu_percent) printf(", cpu.max %d%% of a CPU\n", cpu_percent);
+		else printf(", cpu.max max\n");
+
+		return 0;
+	}
+
+	if (strcmp(args[1], "off") == 0 && args[2] == NULL) {
+		free(cgroup_dir);
+		cgroup_dir = NULL;
+		prune_cgroups();
+
+		return 0;
+	}
+
+	unsigned long long memory = 0;
+	int cpu = 0;
+	int i = 1;
+
+	for (; args[i] != NULL && args[i][0] == '-'; i += 2) {
+		if (args[i + 1] == NULL) {
+			fprintf(stderr, "dragonshell: cgroup: %s: option requires an argument\n", args[i]);
+			return 1;
+		}
+
+		if (strcmp(args[i], "-m") == 0) {
+			if (parse_bytes(args[i + 1], &memory) < 0) {
+				fprintf(stderr, "dragonshell: cgroup: %s: invalid size\n", args[i + 1]);
+				return 1;
+			}
+		}
+
+		else if (strcmp(args[i], "-c") == 0) {
+			char* end;
+			long percent = strtol(args[i + 1], &end, 10);
+
+			if (*end != '\0' || percent <= 0 || percent > 100000) {
+				fprintf(stderr, "dragonshell: cgroup: %s: invalid percentage\n", args[i + 1]);
+				return 1;
+			}
+
+			cpu = (int)percent;
+		}
+
+		else {
+			fprintf(stderr, "dragonshell: cgroup: %s: invalid option\n", args[i]);
+			return 1;
+		}
+	}
+
+	const char* dir = args[i] ? args[i] : var_get("DRAGONSHELL_CGROUP");
+	char procs[PATH_MAX];
+
+	if (!dir || *dir == '\0') {
+		fprintf(stderr, "dragonshell: cgroup: no directory given and DRAGONSHELL_CGROUP is not set\n");
+		return 1;
+	}
+
+	if (snprintf(procs, sizeof(procs), "%s/cgroup.procs", dir) >= (int)sizeof(procs) || access(procs, F_OK) < 0) {
+		fprintf(stderr, "dragonshell: cgroup: %s: not a cgroup directory\n", dir);
+		return 1;
+	}
+
+	// The job cgroups only get the cap files once their parent hands the controllers down
+	const char* controller = NULL;
+
+	if (memory && write_file(dir, "cgroup.subtree_control", "+memory") < 0) controller = "memory";
+
+	else if (cpu && write_file(dir, "cgroup.subtree_control", "+cpu") < 0) controller = "cpu";
+
+	if (controller) {
+		fprintf(stderr, "dragonshell: cgroup: %s: cannot enable the %s controller: %s\n", dir, controller, strerror(errno));
+		return 1;
+	}
+
+	char* copy = strdup(dir);
+
+	if (!copy) {
+		perror("dragonshell: cgroup");
+		return 1;
+	}
+
+	free(cgroup_dir);
+	cgroup_dir = copy;
+	memory_max = memory;
+	cpu_percent = cpu;
+
+	return 0;
+}
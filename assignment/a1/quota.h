@@ -0,0 +1,57 @@
+#ifndef DRAGONSHELL_QUOTA_H
+#define DRAGONSHELL_QUOTA_H
+
+#include "spawn.h"
+
+// Job quotas: ulimit-style resource limits and cgroup v2 caps for the
+// programs the shell starts, never for the shell itself
+
+/**
+ * @brief Give a program the configured resource limits and a job's cgroup
+ *
+ * @param cgroup_fd - From quota_job_cgroup, or -1
+ */
+void quota_apply(struct spawn_io* io, int cgroup_fd);
+
+/**
+ * @brief Create the cgroup for a new job when cgroup caps are on
+ *
+ * Every process of the job joins the same cgroup, so the caps hold for the
+ * whole pipeline. Cgroups of jobs that have ended are removed on the way.
+ *
+ * @param fd - Receives the cgroup's cgroup.procs (for quota_apply), or -1
+ * when caps are off; the caller closes it once the job is started
+ * @return 0, or -1 (with a message printed) if the cgroup could not be made
+ */
+int quota_job_cgroup(int* fd);
+
+/**
+ * @brief Remove every job cgroup that has emptied and forget the settings
+ */
+void quota_clear();
+
+/**
+ * @brief ulimit [-SH] [-a | -t | -v | -n] [limit]
+ *
+ * Shows or sets the limits of CPU seconds (-t), address space in KiB (-v,
+ * the default) and open files (-n) for commands started from now on; the
+ * limit is a number or "unlimited". -S and -H pick the soft or hard limit
+ * (both when setting, the soft one when showing).
+ *
+ * @return 0, or 1 on a bad option or limit
+ */
+int ulimit_command(char** args);
+
+/**
+ * @brief cgroup [-m bytes] [-c percent] [directory] | cgroup off
+ *
+ * Puts each job started from now on in a cgroup of its own under directory
+ * (default $DRAGONSHELL_CGROUP, a delegated cgroup v2 directory) with
+ * memory.max set to bytes (K, M and G suffixes, or "max") and cpu.max to
+ * percent of one CPU. With no arguments, shows the settings.
+ *
+ * @return 0, or 1 if the directory cannot hold job cgroups or an argument is bad
+ */
+int cgroup_command(char** args);
+
+#endif
@@ -0,0 +1,204 @@
+#define _XOPEN_SOURCE 700
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "reader.h"
+
+#define READ_CHUNK 65536 // Initial read buffer, doubled whenever one line outgrows it
+#define SEEK_CHUNK 4096  // Most read at once from a shared seekable fd, which is seeked back after each line
+
+enum { EXACT_NONE, EXACT_SEEK, EXACT_BYTES };
+
+static void reader_reset(struct line_reader* r) {
+	r->fd = -1;
+	r->data = NULL;
+	r->len = 0;
+	r->pos = 0;
+	r->cap = 0;
+	r->mapped = 0;
+	r->tail = NULL;
+	r->exact = EXACT_NONE;
+}
+
+void reader_open_fd(struct line_reader* r, int fd) {
+	reader_reset(r);
+	r->fd = fd;
+
+	if (!isatty(fd)) r->exact = lseek(fd, 0, SEEK_CUR) >= 0 ? EXACT_SEEK : EXACT_BYTES;
+}
+
+int reader_open_file(struct line_reader* r, const char* path) {
+	reader_reset(r);
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0) return -1;
+
+	struct stat st;
+
+	if (fstat(fd, &st) < 0) {
+		int saved = errno;
+		close(fd);
+		errno = saved;
+
+		return -1;
+	}
+
+	// Not a regular file (a fifo, /dev/stdin, ...): fall back to buffered reads
+	if (!S_ISREG(st.st_mode)) {
+		r->fd = fd;
+		return 0;
+	}
+
+	if (st.st_size > 0) {
+		/* A private writable mapping lets us put the '\0' of each line straight
+		into the page, the file itself is never touched */
+		void* map = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+		if (map == MAP_FAILED) {
+			int saved = errno;
+			close(fd);
+			errno = saved;
+
+			return -1;
+		}
+
+		posix_madvise(map, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+
+		r->data = map;
+		r->len = (size_t)st.st_size;
+		r->mapped = 1;
+	}
+
+	close(fd);
+	return 0;
+}
+
+void reader_open_string(struct line_reader* r, char* str) {
+	reader_reset(r);
+
+	r->data = str;
+	r->len = strlen(str);
+}
+
+/**
+ * @brief Read more input into the buffer, growing it if one line fills it
+ *
+ * @return Bytes read, 0 at end of input, -1 on error
+ */
+static ssize_t reader_fill(struct line_reader* r) {
+	// Move the unfinished line to the front of the buffer
+	if (r->pos > 0) {
+		memmove(r->data, r->data + r->pos, r->len - r->pos);
+		r->len -= r->pos;
+		r->pos = 0;
+	}
+
+	// Always keep one spare byte for the '\0' of a last line without newline
+	if (r->len + 1 >= r->cap) {
+		size_t cap = r->cap ? r->cap * 2 : READ_CHUNK;
+		char* grown = realloc(r->data, cap);
+
+		if (grown == NULL) return -1;
+
+		r->data = grown;
+		r->cap = cap;
+	}
+
+	size_t room = r->cap - r->len - 1;
+
+	if (r->exact == EXACT_BYTES) room = 1;
+	else if (r->exact == EXACT_SEEK && room > SEEK_CHUNK) room = SEEK_CHUNK;
+
+	ssize_t n = read(r->fd, r->data + r->len, room);
+
+	if (n > 0) r->len += (size_t)n;
+
+	return n;
+}
+
+int reader_next(struct line_reader* r, char** line) {
+	while (1) {
+		char* start = r->data + r->pos;
+		char* newline = (r->pos < r->len) ? memchr(start, '\n', r->len - r->pos) : NULL;
+
+		if (newline != NULL) {
+			*newline = '\0';
+			r->pos = (size_t)(newline - r->data) + 1;
+			*line = start;
+
+			// Give back what was read past the line
+			if (r->exact == EXACT_SEEK && r->fd >= 0 && r->pos < r->len && lseek(r->fd, -(off_t)(r->len - r->pos), SEEK_CUR) >= 0)
+				r->len = r->pos;
+
+			return 1;
+		}
+
+		if (r->fd >= 0) {
+			ssize_t n = reader_fill(r);
+
+			if (n > 0) continue;
+			if (n < 0 && errno == EINTR) return -1;
+
+			// End of input (or a read error, which ends it too)
+			if (r->fd != STDIN_FILENO) close(r->fd);
+			r->fd = -1;
+
+			continue;
+		}
+
+		if (r->pos >= r->len) return 0;
+
+		// Last line without a newline
+		size_t rest = r->len - r->pos;
+		r->pos = r->len;
+
+		if (!r->mapped) {
+			start[rest] = '\0'; // Spare byte of the read buffer, or the -c string's own '\0'
+			*line = start;
+
+			return 1;
+		}
+
+		/* Past the end of a mapping there is only zero fill up to the page
+		boundary; a file that ends exactly on one needs a copy */
+		long page = sysconf(_SC_PAGESIZE);
+
+		if (r->len % (size_t)page != 0) {
+			*line = start;
+			return 1;
+		}
+
+		free(r->tail);
+		r->tail = malloc(rest + 1);
+
+		if (r->tail == NULL) return 0;
+
+		memcpy(r->tail, start, rest);
+		r->tail[rest] = '\0';
+		*line = r->tail;
+
+		return 1;
+	}
+}
+
+int reader_ready(const struct line_reader* r) {
+	if (r->fd < 0) return 1;
+
+	return r->pos < r->len && memchr(r->data + r->pos, '\n', r->len - r->pos) != NULL;
+}
+
+void reader_close(struct line_reader* r) {
+	if (r->mapped) munmap(r->data, r->len);
+	else if (r->cap > 0) free(r->data);
+
+	if (r->fd >= 0 && r->fd != STDIN_FILENO) close(r->fd);
+
+	free(r->tail);
+	reader_reset(r);
+}
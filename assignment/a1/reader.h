@@ -0,0 +1,64 @@
+#ifndef DRAGONSHELL_READER_H
+#define DRAGONSHELL_READER_H
+
+#include <stddef.h>
+
+// Line reader: hands out input lines of any length with no per-line copying
+
+struct line_reader {
+	int fd;          // Descriptor still being read, or -1
+	char* data;      // Mapped script, -c string or read buffer
+	size_t len;      // Valid bytes in data
+	size_t pos;      // Start of the next line in data
+	size_t cap;      // Size of the read buffer (0 when data is not ours to grow)
+	int mapped;      // Whether data is an mmap of a script file
+	char* tail;      // Copy of a last line that has no room for its '\0'
+	int exact;       // How fd is kept at the end of the last line handed out (EXACT_*)
+};
+
+/**
+ * @brief Read lines from a descriptor (stdin) through a large growable buffer
+ *
+ * Unless fd is a terminal, which hands out a line per read anyway, nothing
+ * past the line being returned is consumed from it: a seekable fd is read in
+ * blocks and seeked back to the end of each line, anything else (a pipe) is
+ * read a byte at a time. The read builtin and the commands the shell runs
+ * share fd with the reader, and they get the lines that follow.
+ */
+void reader_open_fd(struct line_reader* r, int fd);
+
+/**
+ * @brief Read lines from a script file by mapping it into memory
+ *
+ * @return 0 on success, -1 with errno set if the file cannot be opened
+ */
+int reader_open_file(struct line_reader* r, const char* path);
+
+/**
+ * @brief Read lines out of a string (dragonshell -c), which is modified in place
+ */
+void reader_open_string(struct line_reader* r, char* str);
+
+/**
+ * @brief Get the next line, without its newline
+ *
+ * The line lives inside the reader and may be modified by the caller; it
+ * stays valid until the next call.
+ *
+ * @return 1 with *line set, 0 at end of input, -1 if a read was interrupted
+ */
+int reader_next(struct line_reader* r, char** line);
+
+/**
+ * @brief Whether reader_next can return without waiting for more input
+ *
+ * When it cannot, the caller may poll() reader->fd before calling it.
+ */
+int reader_ready(const struct line_reader* r);
+
+/**
+ * @brief Release the buffer or mapping of a reader
+ */
+void reader_close(struct line_reader* r);
+
+#endif
@@ -0,0 +1,356 @@
+#define _XOPEN_SOURCE 700
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Prompt-to-exec latency benchmark: drives an interactive dragonshell over a
+pty (or pipes with -p) the way a user would, and times each command from the
+moment its line is written to the moment the next prompt comes back.
+
+Each workload is one kind of line repeated; the report gives the median and
+99th percentile latency and the commands per second it sustained.
+
+Usage: ./shell_bench [-p] [-n iterations] [-s stages] [shell] */
+
+#define PROMPT "dragonshell> "
+#define TIMEOUT_MS 10000 // A command that takes longer than this means the shell hung
+
+struct workload {
+	const char* name;
+	const char* line;   // Sent with a newline; the stages workload builds its own
+	const char* expect; // Printed by the shell before the prompt that answers the line, or NULL
+};
+
+// Output of the shell not consumed yet, always terminated
+static char buf[65536];
+static size_t buf_len = 0;
+
+static double now_seconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Start the shell with its stdin/stdout/stderr on a pty or on pipes
+ *
+ * HOME points at a scratch directory so the runs do not fill the user's history.
+ *
+ * @param to_shell - Receives the descriptor to write lines to
+ * @param from_shell - Receives the descriptor to read output from
+ * @return The shell's pid, or -1 (with a message printed)
+ */
+static pid_t start_shell(const char* shell, int use_pipes, const char* home, int* to_shell, int* from_shell) {
+	int in[2], out[2];
+	int master = -1;
+	const char* slave = NULL;
+
+	if (use_pipes) {
+		if (pipe(in) < 0 || pipe(out) < 0) {
+			perror("pipe");
+			return -1;
+		}
+	}
+
+	else {
+		master = posix_openpt(O_RDWR | O_NOCTTY);
+
+		if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0 || (slave = ptsname(master)) == NULL) {
+			perror("pty");
+			return -1;
+		}
+	}
+
+	pid_t pid = fork();
+
+	if (pid < 0) {
+		perror("fork");
+		return -1;
+	}
+
+	if (pid == 0) {
+		if (use_pipes) {
+			dup2(in[0], STDIN_FILENO);
+			dup2(out[1], STDOUT_FILENO);
+			dup2(out[1], STDERR_FILENO);
+		}
+
+		else {
+			// A new session whose controlling terminal is the pty, so job control is on
+			setsid();
+
+			int fd = open(slave, O_RDWR);
+
+			if (fd < 0) _exit(127);
+
+			// Without echo only the shell's own output comes back
+			struct termios tio;
+
+			if (tcgetattr(fd, &tio) == 0) {
+				tio.c_lflag &= ~(tcflag_t)ECHO;
+				tcsetattr(fd, TCSANOW, &tio);
+			}
+
+			// Wide enough that the line editor never scrolls a line and redraws the prompt
+			struct winsize ws = {0};
+
+			ws.ws_row = 24;
+			ws.ws_col = 1024;
+			ioctl(fd, TIOCSWINSZ, &ws);
+
+			dup2(fd, STDIN_FILENO);
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+		}
+
+		for (int fd = 3; fd < 64; ++fd) close(fd);
+
+		setenv("HOME", home, 1);
+		execl(shell, shell, (char*)NULL);
+		_exit(127);
+	}
+
+	if (use_pipes) {
+		close(in[0]);
+		close(out[1]);
+
+		*to_shell = in[1];
+		*from_shell = out[0];
+	}
+
+	else *to_shell = *from_shell = master;
+
+	return pid;
+}
+
+/**
+ * @brief Consume the shell's output up to and including the next occurrence of text
+ *
+ * @return 0, or -1 if the shell exited or stayed silent for TIMEOUT_MS
+ */
+static int await(int fd, const char* text) {
+	size_t text_len = strlen(text);
+
+	while (1) {
+		char* found = strstr(buf, text);
+
+		if (found) {
+			size_t used = (size_t)(found - buf) + text_len;
+
+			memmove(buf, buf + used, buf_len - used + 1);
+			buf_len -= used;
+
+			return 0;
+		}
+
+		// Keep only a tail that could be the start of text
+		if (buf_len >= text_len) {
+			memmove(buf, buf + buf_len - (text_len - 1), text_len);
+			buf_len = text_len - 1;
+		}
+
+		struct pollfd pfd = {fd, POLLIN, 0};
+		int ready = poll(&pfd, 1, TIMEOUT_MS);
+
+		if (ready < 0 && errno == EINTR) continue;
+
+		if (ready <= 0) return -1;
+
+		ssize_t n = read(fd, buf + buf_len, sizeof(buf) - 1 - buf_len);
+
+		if (n < 0 && errno == EINTR) continue;
+
+		if (n <= 0) return -1;
+
+		// A NUL in the output would hide what follows it from strstr
+		for (ssize_t i = 0; i < n; ++i)
+			if (buf[buf_len + i] == '\0') buf[buf_len + i] = ' ';
+
+		buf_len += (size_t)n;
+		buf[buf_len] = '\0';
+	}
+}
+
+static int write_line(int fd, const char* line) {
+	size_t len = strlen(line);
+
+	while (len > 0) {
+		ssize_t n = write(fd, line, len);
+
+		if (n < 0 && errno == EINTR) continue;
+
+		if (n < 0) return -1;
+
+		line += n;
+		len -= (size_t)n;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Send a line and wait until the shell has answered it with a prompt
+ *
+ * Background jobs that end print an extra prompt whenever they are reaped;
+ * waiting for expect first skips those stale prompts.
+ */
+static int run_line(int to_shell, int from_shell, const char* line, const char* expect) {
+	if (write_line(to_shell, line) < 0) return -1;
+
+	if (expect && await(from_shell, expect) < 0) return -1;
+
+	return await(from_shell, PROMPT);
+}
+
+/**
+ * @brief Get the shell in a known state: every earlier prompt consumed, no job running
+ */
+static int sync_shell(int to_shell, int from_shell, int round) {
+	char line[64];
+	char marker[32];
+
+	snprintf(marker, sizeof(marker), "sync-%d-done", round);
+	snprintf(line, sizeof(line), "wait; echo %s\n", marker);
+
+	return run_line(to_shell, from_shell, line, marker);
+}
+
+static int compare_doubles(const void* a, const void* b) {
+	double x = *(const double*)a, y = *(const double*)b;
+
+	return (x > y) - (x < y);
+}
+
+int main(int argc, char** argv) {
+	int use_pipes = 0;
+	int iterations = 1000;
+	int stages = 8;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "pn:s:")) != -1) {
+		if (opt == 'p') use_pipes = 1;
+
+		else if (opt == 'n') iterations = atoi(optarg);
+
+		else if (opt == 's') stages = atoi(optarg);
+
+		else {
+			fprintf(stderr, "usage: %s [-p] [-n iterations] [-s stages] [shell]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	const char* shell = optind < argc ? argv[optind] : "./dragonshell";
+
+	if (iterations <= 0) iterations = 1;
+	if (stages < 2) stages = 2;
+
+	// The N-stage pipeline: echo x | cat | cat | ...
+	char* pipeline = malloc(16 + (size_t)stages * 16);
+	double* latencies = malloc((size_t)iterations * sizeof(double));
+
+	if (!pipeline || !latencies) {
+		perror("malloc");
+		return 1;
+	}
+
+	strcpy(pipeline, "echo x");
+
+	for (int i = 1; i < stages; ++i) strcat(pipeline, " | /bin/cat");
+
+	strcat(pipeline, "\n");
+
+	const struct workload workloads[] = {
+		{"builtin", "true\n", NULL},
+		{"exec", "/bin/true\n", NULL},
+		{"pipeline-2", "/bin/true | /bin/true\n", NULL},
+		{"pipeline-N", pipeline, NULL},
+		{"background", "/bin/true &\n", "is sent to background"}
+	};
+	int n_workloads = (int)(sizeof(workloads) / sizeof(workloads[0]));
+
+	char home[] = "/tmp/shell_bench.XXXXXX";
+
+	if (!mkdtemp(home)) {
+		perror("mkdtemp");
+		return 1;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	int to_shell, from_shell;
+	pid_t pid = start_shell(shell, use_pipes, home, &to_shell, &from_shell);
+
+	if (pid < 0) return 1;
+
+	int status = 0;
+
+	if (await(from_shell, PROMPT) < 0) {
+		fprintf(stderr, "%s: no prompt\n", shell);
+		status = 1;
+	}
+
+	printf("%s over %s, %d lines per workload, pipeline-N has %d stages\n", shell, use_pipes ? "pipes" : "a pty", iterations, stages);
+	printf("%-12s %10s %10s %12s\n", "workload", "p50 (us)", "p99 (us)", "cmds/s");
+
+	for (int w = 0; w < n_workloads && status == 0; ++w) {
+		double start = now_seconds();
+
+		for (int i = 0; i < iterations; ++i) {
+			double sent = now_seconds();
+
+			if (run_line(to_shell, from_shell, workloads[w].line, workloads[w].expect) < 0) {
+				fprintf(stderr, "%s: %s: no answer\n", shell, workloads[w].name);
+				status = 1;
+				break;
+			}
+
+			latencies[i] = now_seconds() - sent;
+		}
+
+		if (status != 0) break;
+
+		double elapsed = now_seconds() - start;
+
+		qsort(latencies, (size_t)iterations, sizeof(double), compare_doubles);
+
+		printf("%-12s %10.1f %10.1f %12.0f\n", workloads[w].name, latencies[iterations / 2] * 1e6,
+			latencies[(size_t)(iterations * 0.99)] * 1e6, iterations / elapsed);
+		fflush(stdout);
+
+		// Background jobs are collected before the next workload is timed
+		if (sync_shell(to_shell, from_shell, w) < 0) {
+			fprintf(stderr, "%s: lost sync after %s\n", shell, workloads[w].name);
+			status = 1;
+		}
+	}
+
+	write_line(to_shell, "exit\n");
+	close(to_shell);
+
+	if (from_shell != to_shell) close(from_shell);
+
+	waitpid(pid, NULL, 0);
+
+	char history[sizeof(home) + 32];
+
+	snprintf(history, sizeof(history), "%s/.dragonshell_history", home);
+	unlink(history);
+	rmdir(home);
+
+	free(pipeline);
+	free(latencies);
+
+	return status;
+}
@@ -0,0 +1,300 @@
+#define _XOPEN_SOURCE 700
+#define _GNU_SOURCE // memfd_create()
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <limits.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "spawn.h"
+
+enum spawn_backend spawn_backend = SPAWN_POSIX;
+
+static char* const empty_env[] = {NULL};
+
+void spawn_io_init(struct spawn_io* io) {
+	io->stdin_fd = -1;
+	io->stdout_fd = -1;
+	io->actions = NULL;
+	io->n_actions = 0;
+	io->pgid = -1;
+	io->limits = NULL;
+	io->n_limits = 0;
+	io->cgroup_fd = -1;
+}
+
+int spawn_pipe(int fd[2]) {
+	if (pipe(fd) < 0) return -1;
+
+	if (fcntl(fd[0], F_SETFD, FD_CLOEXEC) < 0 || fcntl(fd[1], F_SETFD, FD_CLOEXEC) < 0) {
+		int saved = errno;
+		close(fd[0]);
+		close(fd[1]);
+		errno = saved;
+
+		return -1;
+	}
+
+	return 0;
+}
+
+static int write_all(int fd, const char* data, size_t len) {
+	while (len > 0) {
+		ssize_t n = write(fd, data, len);
+
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0) return -1;
+
+		data += n;
+		len -= (size_t)n;
+	}
+
+	return 0;
+}
+
+int spawn_data_fd(const char* data, size_t len) {
+	int fd[2];
+
+	// A pipe always has room for PIPE_BUF bytes, so this write cannot block
+	if (len <= PIPE_BUF) {
+		if (spawn_pipe(fd) < 0) return -1;
+
+		if (write_all(fd[1], data, len) < 0) {
+			int saved = errno;
+			close(fd[0]);
+			close(fd[1]);
+			errno = saved;
+
+			return -1;
+		}
+
+		close(fd[1]);
+		return fd[0];
+	}
+
+	int mfd = memfd_create("dragonshell-heredoc", MFD_CLOEXEC);
+
+	if (mfd < 0) return -1;
+
+	if (write_all(mfd, data, len) < 0 || lseek(mfd, 0, SEEK_SET) < 0) {
+		int saved = errno;
+		close(mfd);
+		errno = saved;
+
+		return -1;
+	}
+
+	return mfd;
+}
+
+int spawn_capture_fd() {
+	return memfd_create("dragonshell-output", MFD_CLOEXEC);
+}
+
+/**
+ * @brief posix_spawn backend
+ *
+ * The redirections become file actions, so glibc performs them in the child
+ * between its clone() and the exec, and reports any failure back to us.
+ */
+static pid_t spawn_posix(const char* path, char* const argv[], char* const envp[], const struct spawn_io* io) {
+	posix_spawn_file_actions_t actions;
+	int rc = posix_spawn_file_actions_init(&actions);
+
+	if (rc != 0) {
+		errno = rc;
+		return -1;
+	}
+
+	// Pipe ends first, so an explicit redirection on the same command wins
+	if (io->stdin_fd >= 0 && rc == 0)
+		rc = posix_spawn_file_actions_adddup2(&actions, io->stdin_fd, STDIN_FILENO);
+
+	if (io->stdout_fd >= 0 && rc == 0)
+		rc = posix_spawn_file_actions_adddup2(&actions, io->stdout_fd, STDOUT_FILENO);
+
+	for (int i = 0; i < io->n_actions && rc == 0; ++i) {
+		const struct spawn_action* action = &io->actions[i];
+
+		if (action->type == SPAWN_OPEN)
+			rc = posix_spawn_file_actions_addopen(&actions, action->fd, action->path, action->flags, 0644);
+
+		// glibc clears close-on-exec when a descriptor is dup2'd onto itself
+		else if (action->type == SPAWN_DUP)
+			rc = posix_spawn_file_actions_adddup2(&actions, action->source_fd, action->fd);
+
+		else rc = posix_spawn_file_actions_addclose(&actions, action->fd);
+	}
+
+	posix_spawnattr_t attr;
+	int have_attr = 0;
+
+	if (rc == 0) {
+		rc = posix_spawnattr_init(&attr);
+		have_attr = (rc == 0);
+	}
+
+	// The shell may be blocking SIGCHLD while it spawns; the program must not inherit that
+	sigset_t empty;
+	sigemptyset(&empty);
+	short flags = POSIX_SPAWN_SETSIGMASK;
+
+	if (rc == 0) rc = posix_spawnattr_setsigmask(&attr, &empty);
+
+	if (io->pgid >= 0 && rc == 0) {
+		rc = posix_spawnattr_setpgroup(&attr, io->pgid);
+		flags |= POSIX_SPAWN_SETPGROUP;
+	}
+
+	if (rc == 0) rc = posix_spawnattr_setflags(&attr, flags);
+
+	pid_t pid = -1;
+
+	if (rc == 0) rc = posix_spawn(&pid, path, &actions, &attr, argv, envp);
+
+	if (have_attr) posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&actions);
+
+	if (rc != 0) {
+		errno = rc;
+		return -1;
+	}
+
+	return pid;
+}
+
+/**
+ * @brief Apply the redirections inside a forked child
+ *
+ * @return 0 on success, otherwise the errno of the failing call
+ */
+static int apply_io(const struct spawn_io* io) {
+	if (io->pgid >= 0 && setpgid(0, io->pgid) < 0) return errno;
+
+	// "0" moves the writing process, so the program starts out inside the cgroup
+	if (io->cgroup_fd >= 0 && write(io->cgroup_fd, "0", 1) < 0) return errno;
+
+	for (int i = 0; i < io->n_limits; ++i)
+		if (setrlimit(io->limits[i].resource, &io->limits[i].value) < 0) return errno;
+
+	if (io->stdin_fd >= 0 && dup2(io->stdin_fd, STDIN_FILENO) < 0) return errno;
+	if (io->stdout_fd >= 0 && dup2(io->stdout_fd, STDOUT_FILENO) < 0) return errno;
+
+	for (int i = 0; i < io->n_actions; ++i) {
+		const struct spawn_action* action = &io->actions[i];
+
+		if (action->type == SPAWN_OPEN) {
+			int fd = open(action->path, action->flags, 0644);
+
+			if (fd == -1) return errno;
+
+			if (fd != action->fd) {
+				dup2(fd, action->fd);
+				close(fd);
+			}
+		}
+
+		else if (action->type == SPAWN_DUP) {
+			if (action->source_fd == action->fd) {
+				// Keep it across the exec, like dup2 onto another descriptor would
+				int flags = fcntl(action->fd, F_GETFD);
+
+				if (flags == -1 || fcntl(action->fd, F_SETFD, flags & ~FD_CLOEXEC) == -1) return errno;
+			}
+
+			else if (dup2(action->source_fd, action->fd) < 0) return errno;
+		}
+
+		else close(action->fd);
+	}
+
+	return 0;
+}
+
+/**
+ * @brief fork backend
+ *
+ * A close-on-exec pipe carries the child's errno back if the redirection or
+ * the exec fails, so both backends report errors the same way.
+ */
+static pid_t spawn_fork(const char* path, char* const argv[], char* const envp[], const struct spawn_io* io) {
+	int err_pipe[2];
+
+	if (spawn_pipe(err_pipe) < 0) return -1;
+
+	pid_t pid = fork();
+
+	if (pid < 0) {
+		int saved = errno;
+		close(err_pipe[0]);
+		close(err_pipe[1]);
+		errno = saved;
+
+		return -1;
+	}
+
+	if (pid == 0) {
+		close(err_pipe[0]);
+
+		sigset_t empty;
+		sigemptyset(&empty);
+		sigprocmask(SIG_SETMASK, &empty, NULL);
+
+		int err = apply_io(io);
+
+		if (err == 0) {
+			execve(path, argv, envp);
+			err = errno;
+		}
+
+		ssize_t ignored = write(err_pipe[1], &err, sizeof(err));
+		(void)ignored;
+		_exit(127);
+	}
+
+	/* Set the group from the parent too, so it exists before we hand the
+	terminal to it regardless of which process runs first */
+	if (io->pgid >= 0) setpgid(pid, io->pgid == 0 ? pid : io->pgid);
+
+	close(err_pipe[1]);
+
+	int err = 0;
+	ssize_t n;
+
+	while ((n = read(err_pipe[0], &err, sizeof(err))) < 0 && errno == EINTR);
+
+	close(err_pipe[0]);
+
+	if (n == (ssize_t)sizeof(err)) {
+		// The child never made it to the new program; collect it here
+		waitpid(pid, NULL, 0);
+		errno = err;
+
+		return -1;
+	}
+
+	return pid;
+}
+
+pid_t spawn_program_with(enum spawn_backend backend, const char* path, char* const argv[], char* const envp[], const struct spawn_io* io) {
+	struct spawn_io none;
+
+	if (io == NULL) {
+		spawn_io_init(&none);
+		io = &none;
+	}
+
+	if (envp == NULL) envp = empty_env;
+
+	if (backend == SPAWN_FORK || io->n_limits > 0 || io->cgroup_fd >= 0) return spawn_fork(path, argv, envp, io);
+
+	return spawn_posix(path, argv, envp, io);
+}
+
+pid_t spawn_program(const char* path, char* const argv[], char* const envp[], const struct spawn_io* io) {
+	return spawn_program_with(spawn_backend, path, argv, envp, io);
+}
@@ -0,0 +1,106 @@
+#ifndef DRAGONSHELL_SPAWN_H
+#define DRAGONSHELL_SPAWN_H
+
+#include <sys/types.h>
+#include <sys/resource.h>
+
+// Spawn engine: launches external programs with redirection and pipe wiring
+
+enum spawn_backend {
+	SPAWN_POSIX, // posix_spawn(), the child never copies the shell's page tables
+	SPAWN_FORK   // classic fork() followed by execve()
+};
+
+enum spawn_action_type {
+	SPAWN_OPEN, // Open path onto fd
+	SPAWN_DUP,  // Make fd a copy of source_fd
+	SPAWN_CLOSE // Close fd
+};
+
+// One redirection, performed in the child in the order given
+struct spawn_action {
+	enum spawn_action_type type;
+	int fd;           // Descriptor the action sets up
+	const char* path; // SPAWN_OPEN: file to open
+	int flags;        // SPAWN_OPEN: open() flags; created files get mode 0644
+	int source_fd;    // SPAWN_DUP: descriptor to copy
+};
+
+// A resource limit for the program, set in the child before the exec
+struct spawn_limit {
+	int resource; // RLIMIT_AS, RLIMIT_CPU, RLIMIT_NOFILE, ...
+	struct rlimit value;
+};
+
+struct spawn_io {
+	int stdin_fd;            // Pipe end to install as stdin, or -1
+	int stdout_fd;           // Pipe end to install as stdout, or -1
+	const struct spawn_action* actions; // Redirections, applied after the pipe ends
+	int n_actions;
+	pid_t pgid;              // -1 stay in the shell's group, 0 lead a new group, >0 join that group
+
+	const struct spawn_limit* limits; // Resource limits, or NULL
+	int n_limits;
+	int cgroup_fd;           // cgroup.procs of a cgroup v2 the child moves itself into, or -1
+};
+
+extern enum spawn_backend spawn_backend;
+
+/**
+ * @brief Reset a spawn_io to "inherit everything from the shell"
+ *
+ * @param io - The descriptor set to initialize
+ */
+void spawn_io_init(struct spawn_io* io);
+
+/**
+ * @brief Create a pipe whose ends are closed automatically on exec
+ *
+ * Only the ends that a child installs with dup2 survive into the new program,
+ * so no stage keeps a stray write end open and readers still see EOF.
+ *
+ * @param fd - Receives the read end in fd[0] and the write end in fd[1]
+ * @return 0 on success, -1 on failure with errno set
+ */
+int spawn_pipe(int fd[2]);
+
+/**
+ * @brief Make a descriptor that reads back len bytes of data
+ *
+ * Used for here-documents and here-strings. Bodies that fit in a pipe's
+ * guaranteed capacity are written into a pipe; larger ones into a memfd, so
+ * neither ever touches the disk.
+ *
+ * @return A close-on-exec descriptor positioned at the start of the data,
+ * or -1 with errno set
+ */
+int spawn_data_fd(const char* data, size_t len);
+
+/**
+ * @brief Make an anonymous in-memory file to collect a child's output in
+ *
+ * @return A close-on-exec descriptor, or -1 with errno set
+ */
+int spawn_capture_fd();
+
+/**
+ * @brief Launch a program using the default backend (spawn_backend)
+ *
+ * posix_spawn() can neither set resource limits nor pick a cgroup, so a
+ * program with limits or a cgroup always goes through the fork backend.
+ *
+ * @param path - Path of the executable
+ * @param argv - NULL terminated argument vector
+ * @param envp - NULL terminated environment, may be NULL
+ * @param io - Redirections and pipe ends for the child, may be NULL
+ * @return The child's pid, or -1 with errno set if the child could not be
+ * started (redirection file could not be opened, exec failed, ...)
+ */
+pid_t spawn_program(const char* path, char* const argv[], char* const envp[], const struct spawn_io* io);
+
+/**
+ * @brief Same as spawn_program, but with an explicit backend
+ */
+pid_t spawn_program_with(enum spawn_backend backend, const char* path, char* const argv[], char* const envp[], const struct spawn_io* io);
+
+#endif
@@ -0,0 +1,81 @@
+#define _XOPEN_SOURCE 700
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "spawn.h"
+
+/* Microbenchmark for the spawn engine: launches the same command over and over
+with each backend and reports commands per second.
+
+A ballast allocation stands in for a shell that has grown a large job list and
+history; fork() has to copy its page tables on every launch, posix_spawn() does not.
+
+Usage: ./spawn_bench [iterations] [ballast_mb] [program] */
+
+static double now_seconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static double run_backend(enum spawn_backend backend, const char* program, int iterations) {
+	char* argv[] = {(char*)program, NULL};
+	struct spawn_io io;
+	struct spawn_action to_null = {SPAWN_OPEN, STDOUT_FILENO, "/dev/null", O_WRONLY | O_CREAT | O_TRUNC, -1};
+
+	spawn_io_init(&io);
+	io.actions = &to_null; // Exercise the redirection path too
+	io.n_actions = 1;
+
+	double start = now_seconds();
+
+	for (int i = 0; i < iterations; ++i) {
+		pid_t pid = spawn_program_with(backend, program, argv, NULL, &io);
+
+		if (pid < 0) {
+			perror(program);
+			exit(1);
+		}
+
+		waitpid(pid, NULL, 0);
+	}
+
+	return iterations / (now_seconds() - start);
+}
+
+int main(int argc, char** argv) {
+	int iterations = (argc > 1) ? atoi(argv[1]) : 2000;
+	size_t ballast_mb = (argc > 2) ? (size_t)atol(argv[2]) : 256;
+	const char* program = (argc > 3) ? argv[3] : "/bin/true";
+
+	if (iterations <= 0) iterations = 1;
+
+	char* ballast = malloc(ballast_mb << 20);
+
+	if (ballast_mb > 0 && ballast == NULL) {
+		perror("malloc");
+		return 1;
+	}
+
+	memset(ballast, 1, ballast_mb << 20); // Touch every page so it is really mapped
+
+	printf("%d launches of %s, %zu MB resident ballast\n", iterations, program, ballast_mb);
+
+	double fork_rate = run_backend(SPAWN_FORK, program, iterations);
+	printf("fork+execve  : %10.0f cmds/s\n", fork_rate);
+
+	double spawn_rate = run_backend(SPAWN_POSIX, program, iterations);
+	printf("posix_spawn  : %10.0f cmds/s\n", spawn_rate);
+
+	printf("speedup      : %10.2fx\n", spawn_rate / fork_rate);
+
+	free(ballast);
+	return 0;
+}
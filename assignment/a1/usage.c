@@ -0,0 +1,114 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "usage.h"
+
+static void timeval_add(struct timeval* total, const struct timeval* tv) {
+	total->tv_sec += tv->tv_sec;
+	total->tv_usec += tv->tv_usec;
+
+	if (total->tv_usec >= 1000000) {
+		total->tv_sec++;
+		total->tv_usec -= 1000000;
+	}
+}
+
+static void timeval_sub(struct timeval* diff, const struct timeval* after, const struct timeval* before) {
+	diff->tv_sec = after->tv_sec - before->tv_sec;
+	diff->tv_usec = after->tv_usec - before->tv_usec;
+
+	if (diff->tv_usec < 0) {
+		diff->tv_sec--;
+		diff->tv_usec += 1000000;
+	}
+}
+
+static double seconds(const struct timeval* tv) {
+	return (double)tv->tv_sec + (double)tv->tv_usec / 1e6;
+}
+
+void usage_add(struct rusage* total, const struct rusage* ru) {
+	timeval_add(&total->ru_utime, &ru->ru_utime);
+	timeval_add(&total->ru_stime, &ru->ru_stime);
+
+	if (ru->ru_maxrss > total->ru_maxrss) total->ru_maxrss = ru->ru_maxrss;
+
+	total->ru_minflt += ru->ru_minflt;
+	total->ru_majflt += ru->ru_majflt;
+	total->ru_nvcsw += ru->ru_nvcsw;
+	total->ru_nivcsw += ru->ru_nivcsw;
+}
+
+void usage_sub(struct rusage* diff, const struct rusage* after, const struct rusage* before) {
+	memset(diff, 0, sizeof(*diff));
+
+	timeval_sub(&diff->ru_utime, &after->ru_utime, &before->ru_utime);
+	timeval_sub(&diff->ru_stime, &after->ru_stime, &before->ru_stime);
+
+	// A high-water mark has no difference; report the shell's own
+	diff->ru_maxrss = after->ru_maxrss;
+
+	diff->ru_minflt = after->ru_minflt - before->ru_minflt;
+	diff->ru_majflt = after->ru_majflt - before->ru_majflt;
+	diff->ru_nvcsw = after->ru_nvcsw - before->ru_nvcsw;
+	diff->ru_nivcsw = after->ru_nivcsw - before->ru_nivcsw;
+}
+
+void usage_report(FILE* out, double real, const struct rusage* total, const struct stage_usage* stages, char** names, int n_stages) {
+	fprintf(out, "\nreal\t%.3fs\n", real);
+	fprintf(out, "user\t%.3fs\n", seconds(&total->ru_utime));
+	fprintf(out, "sys\t%.3fs\n", seconds(&total->ru_stime));
+	fprintf(out, "maxrss\t%ld KiB\n", total->ru_maxrss);
+	fprintf(out, "faults\t%ld major, %ld minor\n", total->ru_majflt, total->ru_minflt);
+	fprintf(out, "ctxsw\t%ld voluntary, %ld involuntary\n", total->ru_nvcsw, total->ru_nivcsw);
+
+	if (n_stages < 2) return;
+
+	// One row per stage, so the bottleneck of a pipeline stands out
+	fprintf(out, "\nstage  %9s %9s %10s %8s %8s %8s %8s  command\n", "user", "sys", "maxrss", "majflt", "minflt", "vcsw", "ivcsw");
+
+	for (int i = 0; i < n_stages; ++i) {
+		const struct rusage* ru = &stages[i].ru;
+
+		if (!stages[i].done) {
+			fprintf(out, "%-5d  %9s %9s %10s %8s %8s %8s %8s  %s\n", i + 1, "-", "-", "-", "-", "-", "-", "-", names[i]);
+			continue;
+		}
+
+		fprintf(out, "%-5d  %8.3fs %8.3fs %7ld KiB %8ld %8ld %8ld %8ld  %s\n", i + 1, seconds(&ru->ru_utime), seconds(&ru->ru_stime), ru->ru_maxrss, ru->ru_majflt, ru->ru_minflt, ru->ru_nvcsw, ru->ru_nivcsw, names[i]);
+	}
+}
+
+int usage_live(pid_t pid, double* cpu, long* rss_kb) {
+	char path[64];
+	char buf[1024];
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+
+	FILE* f = fopen(path, "r");
+
+	if (!f) return -1;
+
+	size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+	fclose(f);
+
+	buf[n] = '\0';
+
+	// The command name may hold spaces and parentheses; the fields start after the last ')'
+	char* p = strrchr(buf, ')');
+	unsigned long utime, stime;
+	long rss;
+
+	if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %*d %*d %*d %*d %*d %*d %*u %*u %ld", &utime, &stime, &rss) != 3)
+		return -1;
+
+	long ticks = sysconf(_SC_CLK_TCK);
+	long page_kb = sysconf(_SC_PAGESIZE) / 1024;
+
+	*cpu = (double)(utime + stime) / (double)(ticks > 0 ? ticks : 100);
+	*rss_kb = rss * page_kb;
+
+	return 0;
+}
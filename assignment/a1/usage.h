@@ -0,0 +1,50 @@
+#ifndef DRAGONSHELL_USAGE_H
+#define DRAGONSHELL_USAGE_H
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+// Resource usage: rusage arithmetic, the time report and live process stats
+
+// What one stage of a timed pipeline used, filled in when wait4 reaps it
+struct stage_usage {
+	pid_t pid;     // 0 if the stage could not be started
+	int done;      // Whether ru holds the stage's final usage
+	struct rusage ru;
+};
+
+/**
+ * @brief Add the usage of a reaped process to a running total
+ *
+ * Times, faults and context switches are summed; max RSS is the largest of
+ * the two, since reaped processes did not necessarily run at the same time.
+ */
+void usage_add(struct rusage* total, const struct rusage* ru);
+
+/**
+ * @brief What the shell itself used between two getrusage(RUSAGE_SELF) calls
+ */
+void usage_sub(struct rusage* diff, const struct rusage* after, const struct rusage* before);
+
+/**
+ * @brief Print the report of the time keyword
+ *
+ * @param out - Where to print (stderr, like other shells)
+ * @param real - Wall clock seconds
+ * @param total - Usage of the whole pipeline
+ * @param stages - Per-stage usage, printed as a table when n_stages > 1
+ * @param names - Command name of each stage
+ */
+void usage_report(FILE* out, double real, const struct rusage* total, const struct stage_usage* stages, char** names, int n_stages);
+
+/**
+ * @brief CPU time and resident size of a live process, from /proc/<pid>/stat
+ *
+ * @param cpu - Receives user + system seconds so far
+ * @param rss_kb - Receives the current resident set in KiB
+ * @return 0 on success, -1 if the process is gone or /proc is unavailable
+ */
+int usage_live(pid_t pid, double* cpu, long* rss_kb);
+
+#endif
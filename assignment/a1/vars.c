@@ -0,0 +1,250 @@
+#define _XOPEN_SOURCE 700
+#include <stdlib.h>
+#include <string.h>
+
+#include "vars.h"
+
+#define MIN_VAR_BUCKETS 64 // Initial size of the table, doubled as it fills up
+
+struct variable {
+	char* entry;      // "NAME=value" in one allocation, what envp points at
+	size_t name_len;
+	unsigned int hash;
+	int exported;
+
+	struct variable* next;
+};
+
+static struct variable** buckets = NULL;
+static size_t n_buckets = 0;
+static size_t n_vars = 0;
+
+static char** env_cache = NULL; // envp handed to spawned commands
+static int env_dirty = 1;       // An exported variable changed since env_cache was built
+
+static unsigned int hash_name(const char* name, size_t len) {
+	unsigned int h = 2166136261u; // FNV-1a
+
+	for (size_t i = 0; i < len; ++i) {
+		h ^= (unsigned char)name[i];
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+static struct variable** find_slot(const char* name, size_t len, unsigned int hash) {
+	struct variable** curr = &buckets[hash & (n_buckets - 1)];
+
+	while (*curr) {
+		if ((*curr)->hash == hash && (*curr)->name_len == len && memcmp((*curr)->entry, name, len) == 0) break;
+
+		curr = &(*curr)->next;
+	}
+
+	return curr;
+}
+
+static int grow_table() {
+	size_t size = n_buckets ? n_buckets * 2 : MIN_VAR_BUCKETS;
+	struct variable** table = calloc(size, sizeof(struct variable*));
+
+	if (!table) return n_buckets ? 0 : -1; // A full table still works, just slower
+
+	for (size_t i = 0; i < n_buckets; ++i) {
+		while (buckets[i]) {
+			struct variable* var = buckets[i];
+			buckets[i] = var->next;
+
+			var->next = table[var->hash & (size - 1)];
+			table[var->hash & (size - 1)] = var;
+		}
+	}
+
+	free(buckets);
+	buckets = table;
+	n_buckets = size;
+
+	return 0;
+}
+
+/**
+ * @brief Store name=value, replacing the entry of an existing variable
+ *
+ * @return The variable, or NULL if out of memory
+ */
+static struct variable* store(const char* name, size_t len, const char* value) {
+	if (n_vars >= n_buckets && grow_table() < 0) return NULL;
+
+	unsigned int hash = hash_name(name, len);
+	struct variable** slot = find_slot(name, len, hash);
+	size_t value_len = value ? strlen(value) : 0;
+	char* entry = malloc(len + value_len + 2);
+
+	if (!entry) return NULL;
+
+	memcpy(entry, name, len);
+	entry[len] = '=';
+	memcpy(entry + len + 1, value ? value : "", value_len + 1);
+
+	if (*slot == NULL) {
+		struct variable* var = malloc(sizeof(struct variable));
+
+		if (!var) {
+			free(entry);
+			return NULL;
+		}
+
+		var->entry = NULL;
+		var->name_len = len;
+		var->hash = hash;
+		var->exported = 0;
+		var->next = NULL;
+
+		*slot = var;
+		n_vars++;
+	}
+
+	free((*slot)->entry);
+	(*slot)->entry = entry;
+
+	if ((*slot)->exported) env_dirty = 1;
+
+	return *slot;
+}
+
+void vars_init(char** environ) {
+	for (char** env = environ; env && *env; ++env) {
+		const char* eq = strchr(*env, '=');
+
+		if (!eq || !var_valid_name(*env, (size_t)(eq - *env))) continue;
+
+		struct variable* var = store(*env, (size_t)(eq - *env), eq + 1);
+
+		if (var) var->exported = 1;
+	}
+
+	env_dirty = 1;
+}
+
+const char* var_getn(const char* name, size_t len) {
+	if (n_buckets == 0) return NULL;
+
+	struct variable* var = *find_slot(name, len, hash_name(name, len));
+
+	return var ? var->entry + len + 1 : NULL;
+}
+
+const char* var_get(const char* name) {
+	return var_getn(name, strlen(name));
+}
+
+int var_set(const char* name, const char* value) {
+	return store(name, strlen(name), value) ? 0 : -1;
+}
+
+int var_assign(const char* assignment) {
+	const char* eq = strchr(assignment, '=');
+
+	if (!eq) return var_set(assignment, "");
+
+	return store(assignment, (size_t)(eq - assignment), eq + 1) ? 0 : -1;
+}
+
+int var_export(const char* name) {
+	size_t len = strlen(name);
+	struct variable* var = NULL;
+
+	if (n_buckets) var = *find_slot(name, len, hash_name(name, len));
+
+	if (!var) var = store(name, len, "");
+
+	if (!var) return -1;
+
+	if (!var->exported) {
+		var->exported = 1;
+		env_dirty = 1;
+	}
+
+	return 0;
+}
+
+void var_unset(const char* name) {
+	size_t len = strlen(name);
+
+	if (n_buckets == 0) return;
+
+	struct variable** slot = find_slot(name, len, hash_name(name, len));
+	struct variable* var = *slot;
+
+	if (!var) return;
+
+	*slot = var->next;
+	n_vars--;
+
+	if (var->exported) env_dirty = 1;
+
+	free(var->entry);
+	free(var);
+}
+
+int var_valid_name(const char* name, size_t len) {
+	if (len == 0 || !(name[0] == '_' || (name[0] >= 'a' && name[0] <= 'z') || (name[0] >= 'A' && name[0] <= 'Z'))) return 0;
+
+	for (size_t i = 1; i < len; ++i) {
+		char c = name[i];
+
+		if (!(c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9'))) return 0;
+	}
+
+	return 1;
+}
+
+char** vars_environment() {
+	if (!env_dirty) return env_cache;
+
+	size_t n = 0;
+
+	for (size_t i = 0; i < n_buckets; ++i)
+		for (struct variable* var = buckets[i]; var; var = var->next)
+			if (var->exported) n++;
+
+	char** env = malloc((n + 1) * sizeof(char*));
+
+	if (!env) return NULL;
+
+	n = 0;
+
+	for (size_t i = 0; i < n_buckets; ++i)
+		for (struct variable* var = buckets[i]; var; var = var->next)
+			if (var->exported) env[n++] = var->entry;
+
+	env[n] = NULL;
+
+	free(env_cache);
+	env_cache = env;
+	env_dirty = 0;
+
+	return env_cache;
+}
+
+void vars_clear() {
+	for (size_t i = 0; i < n_buckets; ++i) {
+		while (buckets[i]) {
+			struct variable* var = buckets[i];
+			buckets[i] = var->next;
+
+			free(var->entry);
+			free(var);
+		}
+	}
+
+	free(buckets);
+	free(env_cache);
+
+	buckets = NULL;
+	n_buckets = 0;
+	n_vars = 0;
+	env_cache = NULL;
+	env_dirty = 1;
+}
@@ -0,0 +1,73 @@
+#ifndef DRAGONSHELL_VARS_H
+#define DRAGONSHELL_VARS_H
+
+#include <stddef.h>
+
+// Shell variables: a hash table of NAME=value entries, some of them exported
+
+/**
+ * @brief Fill the table from the environment the shell was started with
+ *
+ * Every inherited variable starts out exported.
+ */
+void vars_init(char** environ);
+
+/**
+ * @brief Look a variable up
+ *
+ * @return Its value (valid until the variable is next set or unset), or NULL
+ */
+const char* var_get(const char* name);
+
+/**
+ * @brief Look a variable up by a name that is not terminated (inside a word)
+ */
+const char* var_getn(const char* name, size_t len);
+
+/**
+ * @brief Set a variable, creating it unexported if it did not exist
+ *
+ * @param name - Must be a valid name (see var_valid_name)
+ * @return 0 on success, -1 if out of memory
+ */
+int var_set(const char* name, const char* value);
+
+/**
+ * @brief Set a variable from one "NAME=value" string
+ */
+int var_assign(const char* assignment);
+
+/**
+ * @brief Mark a variable exported, creating it empty if it did not exist
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+int var_export(const char* name);
+
+/**
+ * @brief Remove a variable (nothing happens if it does not exist)
+ */
+void var_unset(const char* name);
+
+/**
+ * @brief Whether the first len characters are a name: [A-Za-z_][A-Za-z0-9_]*
+ */
+int var_valid_name(const char* name, size_t len);
+
+/**
+ * @brief The exported variables as an envp array for execve
+ *
+ * The array is cached and only rebuilt after an exported variable changed,
+ * so spawning a command does not copy the environment.
+ *
+ * @return NULL terminated "NAME=value" strings, valid until the next change;
+ * NULL if out of memory
+ */
+char** vars_environment();
+
+/**
+ * @brief Free every variable
+ */
+void vars_clear();
+
+#endif
@@ -1,15 +1,39 @@
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE // accept4(), eventfd(), pthread_setaffinity_np(), syscall(), splice()
+
+// Build: gcc -O2 -pthread concurrent_tcp_server.c -o concurrent_tcp_server
+
+/* Concurrent TCP echo server. --mode= picks how connections are served:
+- fork (default): one child process per connection
+- epoll: one thread running an edge-triggered epoll loop
+- reactors: one CPU-pinned epoll loop per core (--threads=N), each with its
+  own SO_REUSEPORT listener
+- prefork: a pool of workers forked up front (--workers=N) that block in
+  accept(), are restarted when they die and are replaced after
+  --max-conns=N connections
+- uring: an io_uring loop (raw syscalls, multishot accept and recv into a
+  provided buffer ring, linked sends), or epoll on kernels without it
+The fork and prefork modes echo bulk streams with splice() through a pipe,
+so their bytes never enter user space */
 
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
 #include <netdb.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -22,8 +46,20 @@
 #define NI_MAXSERV 32
 #endif
 
+#define EPOLL_MAX_EVENTS 256
+#define EPOLL_BUF_SIZE 65536   // One receive buffer per event loop, shared by all its connections
+#define MAX_PENDING (1 << 20)  // Unsent echo bytes a connection may hold before we stop reading it
+#define MAX_WORKERS 256        // Largest pre-fork pool
+#define STOP_GRACE_MS 2000     // Time pre-fork workers get to finish their client before SIGKILL
+#define FORK_RETRY_MS 1000     // Wait before refilling the pre-fork pool after fork() failed
+#define SPLICE_PIPE_SIZE (256 * 1024) // Pipe the splice echo path asks for (the default is 64 KiB)
+
 static volatile sig_atomic_t keep_running = 1;
 
+// Pre-fork pool: pid of the worker in each slot, 0 once on_sigchld has reaped it
+static volatile sig_atomic_t worker_pids[MAX_WORKERS];
+static volatile sig_atomic_t n_worker_slots = 0;
+
 static void on_term(int sig) {
     (void)sig;
     keep_running = 0;
@@ -54,7 +90,12 @@ static void on_sigchld(int sig) {
         int status;
         pid_t pid = waitpid(-1, &status, WNOHANG);
 
-        if (pid < 0) break;
+        // 0: the other children are still running
+        if (pid <= 0) break;
+
+        // A pool worker's slot is freed for the supervisor to refill
+        for (int i = 0; i < n_worker_slots; ++i)
+            if (worker_pids[i] == pid) worker_pids[i] = 0;
     }
 
     errno = saved;
@@ -78,19 +119,88 @@ static ssize_t send_all(int fd, const void* buf, size_t len) {
     return (ssize_t)sent;
 }
 
-static void handle_client_echo(int cfd) {
+// Numeric address and port of the other end of a connection
+
+static bool peer_name(int cfd, char* host, size_t host_len, char* serv, size_t serv_len) {
     struct sockaddr_storage ss;
     socklen_t slen = sizeof(ss);
+
+    return getpeername(cfd, (struct sockaddr*)&ss, &slen) == 0 &&
+        getnameinfo((struct sockaddr*)&ss, slen, host, host_len, serv, serv_len, NI_NUMERICHOST | NI_NUMERICSERV) == 0;
+}
+
+/* Zero-copy echo: socket -> pipe -> the same socket. splice() moves references
+to the socket's pages into the pipe and back out, so the payload never enters
+user space. Returns the bytes echoed (at most pipe_size), 0 at end of input,
+or -1 on error */
+
+static ssize_t splice_echo(int cfd, const int pipe_fd[2], size_t pipe_size) {
+    ssize_t in;
+
+    // Blocks until data arrives, then takes what is there, up to what the (empty) pipe holds
+    do in = splice(cfd, NULL, pipe_fd[1], NULL, pipe_size, SPLICE_F_MOVE);
+    while (in < 0 && errno == EINTR);
+
+    if (in <= 0) return in;
+
+    for (ssize_t out = 0; out < in;) {
+        ssize_t n = splice(pipe_fd[0], NULL, cfd, NULL, (size_t)(in - out), SPLICE_F_MOVE);
+
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+
+        out += n;
+    }
+
+    return in;
+}
+
+static void handle_client_echo(int cfd) {
     char host[NI_MAXHOST], serv[NI_MAXSERV];
 
-    if (getpeername(cfd, (struct sockaddr*)&ss, &slen) == 0 && 
-        getnameinfo((struct sockaddr*)&ss, slen, host, sizeof(host), serv, sizeof(serv), NI_NUMERICHOST | NI_NUMERICSERV) == 0)
-            
+    if (peer_name(cfd, host, sizeof(host), serv, sizeof(serv)))
         fprintf(stderr, "[child %d] Connected: %s %s\n", getpid(), host, serv);
 
     char buf[4096];
 
+    // Small messages are cheapest copied; a read that fills buf means a stream, which is spliced
+    bool bulk = false;
+    int pipe_fd[2] = {-1, -1};
+    size_t pipe_size = 0;
+
     while (1) {
+        if (bulk && pipe_fd[0] == -1) {
+            if (pipe2(pipe_fd, O_CLOEXEC) < 0) {
+                perror("pipe2");
+                pipe_fd[0] = -2; // Copy only from now on
+            }
+
+            else {
+                int size = fcntl(pipe_fd[0], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+
+                // Over /proc/sys/fs/pipe-max-size or the user's pipe quota: keep the default
+                if (size < 0) size = fcntl(pipe_fd[0], F_GETPIPE_SZ);
+
+                pipe_size = size > 0 ? (size_t)size : 65536;
+            }
+        }
+
+        if (bulk && pipe_fd[0] >= 0) {
+            ssize_t n = splice_echo(cfd, pipe_fd, pipe_size);
+            if (n == 0) break; // client closed
+
+            if (n < 0) {
+                perror("splice");
+                break;
+            }
+
+            // The stream paused; what comes next may be small again
+            bulk = (size_t)n >= sizeof(buf);
+            continue;
+        }
+
         ssize_t n = recv(cfd, buf, sizeof(buf), 0);
         if (n == 0) break; // client closed
 
@@ -104,12 +214,21 @@ static void handle_client_echo(int cfd) {
             perror("send");
             break;
         }
+
+        bulk = (size_t)n == sizeof(buf);
+    }
+
+    if (pipe_fd[0] >= 0) {
+        close(pipe_fd[0]);
+        close(pipe_fd[1]);
     }
 
     fprintf(stderr, "[child %d] Disconnected\n", getpid());
 }
 
-static int make_listener(const char* port) {
+// reuse_port: several sockets may bind the port, and the kernel spreads new connections over them
+
+static int make_listener(const char* port, bool reuse_port) {
     struct addrinfo hints, *res = NULL, *rp;
 
     memset(&hints, 0, sizeof(hints));
@@ -140,6 +259,14 @@ static int make_listener(const char* port) {
             continue;
         }
 
+        if (reuse_port && setsockopt(lfd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) < 0) {
+            perror("setsockopt(SO_REUSEPORT)");
+            close(lfd);
+            lfd = -1;
+
+            continue;
+        }
+
         #ifdef IPV6_V6ONLY
             if (rp->ai_family == AF_INET6) {
                 int no = 0;
@@ -189,7 +316,7 @@ static void install_signals() {
 }
 
 int tcp_server_fork(const char* port) {
-    int lfd = make_listener(port);
+    int lfd = make_listener(port, false);
 
     if (lfd < 0) return EXIT_FAILURE;
 
@@ -232,9 +359,1385 @@ int tcp_server_fork(const char* port) {
     return EXIT_SUCCESS;
 }
 
-int main(int argc, char* argv[]) {
-    const char* port = (argc > 1)? argv[1]: "8080";
-    install_signals();
+/* Event-driven mode: one thread, one epoll instance, every socket non-blocking.
+
+Sockets are registered edge-triggered for both directions once, when they are
+accepted, so the loop never calls epoll_ctl() again for them: an edge means
+"something changed", and the handler then reads (or writes) until EAGAIN.
+
+Echo semantics are those of handle_client_echo(): what arrives is sent back.
+A send that the socket only partly takes leaves the rest in the connection's
+pending buffer, which is flushed on the next EPOLLOUT edge. An idle connection
+costs a struct conn and no buffer, so tens of thousands of them are cheap */
+
+struct conn {
+    int fd;
+    char* pending;      // Echo bytes the socket has not taken yet, NULL until a send falls short
+    size_t pending_off; // First unsent byte
+    size_t pending_len; // End of the unsent bytes
+    size_t pending_cap;
+    bool read_paused;   // pending is full: reading resumes once it drains
+    bool peer_closed;   // Client finished sending; close once pending is flushed
+
+    struct conn* prev;  // All connections of the loop, to close them on shutdown
+    struct conn* next;
+};
+
+struct reactor {
+    int epfd;
+    int lfd;
+    int stop_fd;        // Becomes readable when the server shuts down (-1 if none)
+    char tag[32];       // Prefix of the log lines
+    struct conn* conns;
+    size_t n_conns;
+    bool accept_stalled; // accept4() failed with connections still queued (EMFILE and friends)
+    char buf[EPOLL_BUF_SIZE];
+};
+
+// Every connection is a descriptor; the default soft limit (often 1024) is far too low
+
+static void raise_fd_limit() {
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+
+        if (setrlimit(RLIMIT_NOFILE, &rl) < 0) perror("setrlimit");
+    }
+}
+
+static bool queue_pending(struct conn* c, const char* data, size_t len) {
+    // Move the unsent bytes to the front before growing
+    if (c->pending_off > 0) {
+        memmove(c->pending, c->pending + c->pending_off, c->pending_len - c->pending_off);
+        c->pending_len -= c->pending_off;
+        c->pending_off = 0;
+    }
+
+    if (c->pending_len + len > c->pending_cap) {
+        size_t cap = c->pending_cap ? c->pending_cap : 4096;
+
+        while (cap < c->pending_len + len) cap *= 2;
+
+        char* bigger = realloc(c->pending, cap);
+
+        if (!bigger) {
+            perror("realloc");
+            return false;
+        }
+
+        c->pending = bigger;
+        c->pending_cap = cap;
+    }
+
+    memcpy(c->pending + c->pending_len, data, len);
+    c->pending_len += len;
+
+    return true;
+}
+
+// Send as much as the socket takes; returns the number of bytes sent, or -1 on error
+
+static ssize_t send_some(int fd, const char* data, size_t len) {
+    size_t sent = 0;
+
+    while (sent < len) {
+        // MSG_NOSIGNAL: a client that went away must not kill the whole server with SIGPIPE
+        ssize_t n = send(fd, data + sent, len - sent, MSG_NOSIGNAL);
+
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return -1;
+        }
+
+        sent += (size_t)n;
+    }
+
+    return (ssize_t)sent;
+}
+
+// Returns false when the connection should be closed
+
+static bool flush_pending(struct conn* c) {
+    ssize_t n = send_some(c->fd, c->pending + c->pending_off, c->pending_len - c->pending_off);
+
+    if (n < 0) {
+        if (errno != ECONNRESET && errno != EPIPE) perror("send");
+        return false;
+    }
+
+    c->pending_off += (size_t)n;
+
+    if (c->pending_off == c->pending_len) {
+        // Drained: give the memory back, an idle connection keeps no buffer
+        free(c->pending);
+        c->pending = NULL;
+        c->pending_off = c->pending_len = c->pending_cap = 0;
+    }
+
+    return true;
+}
+
+static bool on_readable(struct reactor* r, struct conn* c) {
+    while (!c->read_paused && !c->peer_closed) {
+        ssize_t n = recv(c->fd, r->buf, sizeof(r->buf), 0);
+
+        if (n == 0) {
+            // Client closed; whatever it sent last still goes back first
+            c->peer_closed = true;
+            break;
+        }
+
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            if (errno != ECONNRESET) perror("recv");
+            return false;
+        }
+
+        ssize_t sent = 0;
+
+        // Nothing queued yet: send straight from the shared buffer, which is the common case
+        if (c->pending_off == c->pending_len) sent = send_some(c->fd, r->buf, (size_t)n);
+
+        if (sent < 0) {
+            if (errno != ECONNRESET && errno != EPIPE) perror("send");
+            return false;
+        }
+
+        if (sent < n && !queue_pending(c, r->buf + sent, (size_t)(n - sent))) return false;
+
+        // A client that sends without reading gets no more than MAX_PENDING of our memory
+        if (c->pending_len - c->pending_off >= MAX_PENDING) c->read_paused = true;
+    }
+
+    return !(c->peer_closed && c->pending_off == c->pending_len);
+}
+
+static bool on_writable(struct reactor* r, struct conn* c) {
+    if (c->pending_off < c->pending_len && !flush_pending(c)) return false;
+
+    if (c->pending_off < c->pending_len) return true;
+
+    if (c->peer_closed) return false;
+
+    // Edge-triggered: data that arrived while paused produced no new edge, so read it now
+    if (c->read_paused) {
+        c->read_paused = false;
+        return on_readable(r, c);
+    }
+
+    return true;
+}
+
+static void close_conn(struct reactor* r, struct conn* c) {
+    if (c->prev) c->prev->next = c->next;
+    else r->conns = c->next;
+
+    if (c->next) c->next->prev = c->prev;
+
+    r->n_conns--;
+
+    // Closing the last descriptor of a socket also removes it from the epoll set
+    close(c->fd);
+    free(c->pending);
+    free(c);
+}
+
+static void accept_ready(struct reactor* r) {
+    while (1) {
+        // One call instead of accept() + fcntl(): the socket starts out non-blocking
+        int cfd = accept4(r->lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (cfd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                r->accept_stalled = false;
+                return;
+            }
+
+            /* EMFILE and friends: the pending connections stay queued, and the
+            edge-triggered listener reports no new edge for them, so the loop
+            calls us again whenever a connection closes. Logged once per stall */
+            if (!r->accept_stalled) perror("accept");
+
+            r->accept_stalled = true;
+            return;
+        }
+
+        struct conn* c = calloc(1, sizeof(struct conn));
+
+        if (!c) {
+            perror("calloc");
+            close(cfd);
+            continue;
+        }
+
+        c->fd = cfd;
+
+        struct epoll_event ev;
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = c;
+
+        if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, cfd, &ev) < 0) {
+            perror("epoll_ctl");
+            close(cfd);
+            free(c);
+            continue;
+        }
+
+        c->next = r->conns;
+        if (r->conns) r->conns->prev = c;
+        r->conns = c;
+        r->n_conns++;
+
+        char host[NI_MAXHOST], serv[NI_MAXSERV];
+
+        if (peer_name(cfd, host, sizeof(host), serv, sizeof(serv)))
+            fprintf(stderr, "[%s] Connected: %s %s (%zu open)\n", r->tag, host, serv, r->n_conns);
+    }
+}
+
+// Creates the epoll set with the listener (already non-blocking) and stop_fd in it
+
+static int reactor_open(struct reactor* r) {
+    struct epoll_event ev;
+
+    r->epfd = epoll_create1(EPOLL_CLOEXEC);
+
+    if (r->epfd < 0) {
+        perror("epoll_create1");
+        return -1;
+    }
+
+    // data.ptr NULL marks the listener
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = NULL;
+
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->lfd, &ev) < 0) {
+        perror("epoll_ctl");
+        close(r->epfd);
+        return -1;
+    }
+
+    // Level-triggered and never read, so it wakes every loop it is registered in
+    ev.events = EPOLLIN;
+    ev.data.ptr = &r->stop_fd;
+
+    if (r->stop_fd >= 0 && epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->stop_fd, &ev) < 0) {
+        perror("epoll_ctl");
+        close(r->epfd);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Runs until SIGINT / SIGTERM, then closes what reactor_open() made
+
+static int reactor_run(struct reactor* r) {
+    struct epoll_event events[EPOLL_MAX_EVENTS];
+
+    while (keep_running) {
+        int n = epoll_wait(r->epfd, events, EPOLL_MAX_EVENTS, -1);
+
+        if (n < 0) {
+            if (errno == EINTR) continue; // keep_running is checked again
+            perror("epoll_wait");
+            break;
+        }
+
+        bool closed = false;
+
+        for (int i = 0; i < n; ++i) {
+            struct conn* c = events[i].data.ptr;
+            uint32_t e = events[i].events;
+
+            if (!c) {
+                accept_ready(r);
+                continue;
+            }
+
+            if (events[i].data.ptr == &r->stop_fd) continue; // keep_running is already 0
+
+            // EPOLLHUP: both directions are gone, nothing can be echoed any more
+            bool alive = !(e & (EPOLLERR | EPOLLHUP));
+
+            if (alive && (e & EPOLLOUT)) alive = on_writable(r, c);
+            if (alive && (e & (EPOLLIN | EPOLLRDHUP))) alive = on_readable(r, c);
+
+            if (!alive) {
+                fprintf(stderr, "[%s] Disconnected (%zu open)\n", r->tag, r->n_conns - 1);
+                close_conn(r, c);
+                closed = true;
+            }
+        }
+
+        // A descriptor freed up for a connection still in the backlog
+        if (r->accept_stalled && closed) accept_ready(r);
+    }
+
+    while (r->conns) close_conn(r, r->conns);
+
+    close(r->epfd);
+    return 0;
+}
+
+static int make_nonblocking_listener(const char* port, bool reuse_port) {
+    int lfd = make_listener(port, reuse_port);
+
+    if (lfd >= 0 && fcntl(lfd, F_SETFL, fcntl(lfd, F_GETFL) | O_NONBLOCK) < 0) {
+        perror("fcntl");
+        close(lfd);
+        return -1;
+    }
+
+    return lfd;
+}
+
+int tcp_server_epoll(const char* port) {
+    int lfd = make_nonblocking_listener(port, false);
+
+    if (lfd < 0) return EXIT_FAILURE;
+
+    raise_fd_limit();
+
+    struct reactor* r = calloc(1, sizeof(struct reactor));
+
+    if (!r) {
+        perror("calloc");
+        close(lfd);
+        return EXIT_FAILURE;
+    }
+
+    r->lfd = lfd;
+    r->stop_fd = -1; // SIGINT / SIGTERM interrupt epoll_wait() in the only thread
+    strcpy(r->tag, "epoll");
+
+    int rc = reactor_open(r);
+
+    if (rc == 0) {
+        fprintf(stderr, "[*] Listening on port %s (epoll, single thread)\n", port);
+        rc = reactor_run(r);
+    }
+
+    free(r);
+    close(lfd);
+
+    fprintf(stderr, "[*] Server shut down.\n");
+    return rc < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* Multi-reactor mode: N threads, each pinned to its own CPU with its own
+SO_REUSEPORT listener and epoll loop. The kernel hashes every new connection
+to one of the listeners, so there is no shared accept queue or lock, and a
+connection stays on the core that accepted it for its whole life.
+
+Only the main thread takes SIGINT / SIGTERM; it then writes the stop eventfd,
+which every loop has registered */
+
+struct worker {
+    pthread_t thread;
+    int cpu;            // CPU to pin to, or -1
+    struct reactor* r;
+};
+
+static void* worker_main(void* arg) {
+    struct worker* w = arg;
+
+    if (w->cpu >= 0) {
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET(w->cpu, &set);
+
+        int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+        if (rc != 0) fprintf(stderr, "[%s] pthread_setaffinity_np: %s\n", w->r->tag, strerror(rc));
+    }
+
+    reactor_run(w->r);
+    return NULL;
+}
+
+int tcp_server_reactors(const char* port, int n_threads) {
+    // Pin to the CPUs this process may use (taskset / cgroups), in order
+    cpu_set_t allowed;
+    int cpus[CPU_SETSIZE];
+    int n_cpus = 0;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            if (CPU_ISSET(cpu, &allowed)) cpus[n_cpus++] = cpu;
+
+    if (n_threads <= 0) n_threads = n_cpus > 0 ? n_cpus : 1;
+
+    raise_fd_limit();
+
+    int stop_fd = eventfd(0, EFD_CLOEXEC);
+    struct worker* workers = calloc((size_t)n_threads, sizeof(struct worker));
+
+    if (stop_fd < 0 || !workers) {
+        perror(stop_fd < 0 ? "eventfd" : "calloc");
+        if (stop_fd >= 0) close(stop_fd);
+        free(workers);
+        return EXIT_FAILURE;
+    }
+
+    // Workers inherit this mask, so the signals always land in the main thread
+    sigset_t stop_signals, old;
+
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, &old);
+
+    int started = 0;
+
+    for (; started < n_threads; ++started) {
+        struct worker* w = &workers[started];
+
+        w->cpu = n_cpus > 0 ? cpus[started % n_cpus] : -1;
+        w->r = calloc(1, sizeof(struct reactor));
+
+        if (!w->r) {
+            perror("calloc");
+            break;
+        }
+
+        w->r->stop_fd = stop_fd;
+        snprintf(w->r->tag, sizeof(w->r->tag), "reactor %d", started);
+
+        // Every worker binds the port itself; without SO_REUSEPORT the second bind would fail
+        w->r->lfd = make_nonblocking_listener(port, true);
+
+        if (w->r->lfd < 0) {
+            free(w->r);
+            break;
+        }
+
+        /* Set up here rather than in the thread: a listener whose loop never
+        started would still get its share of the connections, and hang them */
+        if (reactor_open(w->r) < 0) {
+            close(w->r->lfd);
+            free(w->r);
+            break;
+        }
+
+        int rc = pthread_create(&w->thread, NULL, worker_main, w);
+
+        if (rc != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(rc));
+            close(w->r->epfd);
+            close(w->r->lfd);
+            free(w->r);
+            break;
+        }
+    }
+
+    if (started == n_threads)
+        fprintf(stderr, "[*] Listening on port %s (%d reactors, SO_REUSEPORT)\n", port, n_threads);
+
+    else keep_running = 0;
+
+    // Sleep until SIGINT / SIGTERM runs on_term
+    while (keep_running) sigsuspend(&old);
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    uint64_t one = 1;
+
+    if (write(stop_fd, &one, sizeof(one)) < 0) perror("write");
+
+    for (int i = 0; i < started; ++i) {
+        pthread_join(workers[i].thread, NULL);
+        close(workers[i].r->lfd);
+        free(workers[i].r);
+    }
+
+    close(stop_fd);
+    free(workers);
+
+    fprintf(stderr, "[*] Server shut down.\n");
+    return started == n_threads ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* Pre-fork mode: a fixed pool of worker processes, forked up front, that all
+block in accept() on the one listener (Linux wakes a single waiter per
+connection). A connection is served by a process that already exists, so no
+fork lies between a client's connect and its first echo.
+
+A worker exits after max_conns connections, so leaks or fragmentation in a
+long-lived worker cannot pile up. on_sigchld reaps it and frees its slot;
+the supervisor, asleep in sigsuspend(), wakes on that SIGCHLD and forks a
+replacement */
+
+static void prefork_worker(int lfd, int max_conns) {
+    int served = 0;
+
+    while (keep_running && (max_conns <= 0 || served < max_conns)) {
+        int cfd = accept(lfd, NULL, NULL);
+
+        if (cfd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            perror("accept");
+            break;
+        }
+
+        handle_client_echo(cfd);
+        close(cfd);
+
+        served++;
+    }
+
+    _exit(0);
+}
+
+static int live_workers() {
+    int live = 0;
+
+    for (int i = 0; i < n_worker_slots; ++i)
+        if (worker_pids[i] != 0) live++;
+
+    return live;
+}
+
+int tcp_server_prefork(const char* port, int n_workers, int max_conns) {
+    if (n_workers <= 0) n_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (n_workers <= 0) n_workers = 1;
+    if (n_workers > MAX_WORKERS) n_workers = MAX_WORKERS;
+
+    int lfd = make_listener(port, false);
+
+    if (lfd < 0) return EXIT_FAILURE;
+
+    // Slots are only looked at with these blocked, so on_sigchld cannot change one halfway
+    sigset_t blocked, old;
+
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGCHLD);
+    sigaddset(&blocked, SIGINT);
+    sigaddset(&blocked, SIGTERM);
+    sigprocmask(SIG_BLOCK, &blocked, &old);
+
+    for (int i = 0; i < n_workers; ++i) worker_pids[i] = 0;
+
+    n_worker_slots = n_workers;
+
+    fprintf(stderr, "[*] Listening on port %s (pre-fork, %d workers, %d connections each%s)\n",
+        port, n_workers, max_conns, max_conns > 0 ? "" : " = unlimited");
+
+    while (keep_running) {
+        bool fork_failed = false;
+
+        for (int i = 0; i < n_workers; ++i) {
+            if (worker_pids[i] != 0) continue;
+
+            pid_t pid = fork();
+
+            if (pid < 0) {
+                perror("fork");
+                fork_failed = true;
+                break;
+            }
+
+            if (pid == 0) {
+                sigprocmask(SIG_SETMASK, &old, NULL);
+                prefork_worker(lfd, max_conns);
+            }
+
+            worker_pids[i] = pid;
+            fprintf(stderr, "[*] Worker %d started in slot %d\n", pid, i);
+        }
+
+        // Atomically unblock and wait: a worker dying or SIGINT / SIGTERM wakes us
+        if (!fork_failed) sigsuspend(&old);
+
+        // Slots stay empty, and with no worker left no SIGCHLD would come: try again in a while
+        else {
+            struct timespec retry = {FORK_RETRY_MS / 1000, (FORK_RETRY_MS % 1000) * 1000 * 1000};
+
+            sigprocmask(SIG_SETMASK, &old, NULL);
+            nanosleep(&retry, NULL);
+            sigprocmask(SIG_BLOCK, &blocked, NULL);
+        }
+    }
+
+    // Workers in accept() stop right away; one serving a client gets a grace period
+    for (int i = 0; i < n_workers; ++i)
+        if (worker_pids[i] != 0) kill(worker_pids[i], SIGTERM);
+
+    struct timespec tick = {0, 10 * 1000 * 1000};
+
+    for (int waited = 0; live_workers() > 0 && waited < STOP_GRACE_MS; waited += 10) {
+        sigprocmask(SIG_SETMASK, &old, NULL);
+        nanosleep(&tick, NULL);
+        sigprocmask(SIG_BLOCK, &blocked, NULL);
+    }
+
+    for (int i = 0; i < n_workers; ++i)
+        if (worker_pids[i] != 0) kill(worker_pids[i], SIGKILL);
+
+    while (live_workers() > 0) sigsuspend(&old);
+
+    n_worker_slots = 0;
+    sigprocmask(SIG_SETMASK, &old, NULL);
+
+    close(lfd);
+
+    fprintf(stderr, "[*] Server shut down.\n");
+    return EXIT_SUCCESS;
+}
+
+/* io_uring mode: one thread, one ring, and almost no syscalls per message.
+
+Three kinds of request keep the server going, each posting completions
+without being submitted again:
+- one multishot accept on the listener, which completes once per new client
+- one multishot recv per connection, which picks a buffer from a ring of
+  buffers registered with the kernel (a "provided buffer ring") for every
+  chunk it receives, so no buffer sits idle under a quiet connection
+- the echo: the buffers a connection received are sent back, in order, as
+  one chain of sends linked with IOSQE_IO_LINK, so they cannot overtake each
+  other; a buffer goes back to the ring once it has been sent
+
+io_uring_enter() submits everything queued and waits for completions in the
+same call, so a loaded server makes one syscall for a whole batch of
+messages, where the epoll loop makes a recv() and a send() per message.
+
+The raw syscalls are used (there is no liburing here). Kernels that lack
+io_uring, or one of the features above (multishot recv needs 6.0), or that
+have it disabled, get the epoll loop instead */
+
+#define URING_ENTRIES 1024     // Submission queue slots; the completion queue has 4 times as many
+#define URING_BUFS 4096        // Provided buffers, shared by all connections (a power of 2)
+#define URING_BUF_SIZE 4096
+#define URING_BGID 0           // Buffer group ID of the provided buffer ring
+#define URING_MAX_CHAIN 16     // Most sends linked into one chain
+
+// Low bits of a completion's user_data: what finished (connections are at least 8-aligned)
+enum uring_op { OP_ACCEPT = 0, OP_RECV = 1, OP_SEND = 2, OP_CANCEL = 3 };
+
+struct uring_conn {
+    int fd;
+    unsigned inflight;  // Requests the kernel holds that point here; freed only at 0
+    int head;           // Buffers received and not yet echoed, by ID, in order (-1: none)
+    int tail;
+    size_t queued;      // Bytes in those buffers still to send
+    unsigned sending;   // Sends of the current chain not completed yet
+    bool recv_armed;
+    bool read_paused;   // queued reached MAX_PENDING: recv is cancelled until it drains
+    bool starved;       // recv stopped because every buffer was in use
+    bool peer_closed;
+    bool failed;        // A send failed; close once the rest of its chain has completed
+    bool closing;
+
+    struct uring_conn* prev;
+    struct uring_conn* next;
+    struct uring_conn* next_starved;
+};
+
+// A provided buffer while a connection holds it
+struct uring_buf {
+    int next;           // Next buffer of the same connection, -1 for none
+    unsigned len;       // Bytes received into it
+    unsigned off;       // Bytes of those already sent
+};
+
+struct uring {
+    int fd;
+    int lfd;
+    bool accept_armed;
+    bool accept_stalled;  // Accept failed (EMFILE and friends); rearmed once a connection closes
+    int accept_error;     // Last accept error logged, 0 after a success: logged once per run of them
+
+    // Submission queue: the kernel owns head, we own tail
+    _Atomic unsigned* sq_head;
+    _Atomic unsigned* sq_tail;
+    unsigned sq_mask;
+    unsigned sq_local_tail;  // Tail including the entries not published yet
+    struct io_uring_sqe* sqes;
+
+    // Completion queue: we own head, the kernel owns tail
+    _Atomic unsigned* cq_head;
+    _Atomic unsigned* cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe* cqes;
+
+    void* ring_mem;
+    size_t ring_size;
+    size_t sqes_size;
+
+    struct io_uring_buf_ring* br; // Provided buffer ring, the kernel takes buffers from it
+    _Atomic uint16_t* br_tail;
+    uint16_t br_local_tail;
+    char* bufs;
+    struct uring_buf meta[URING_BUFS];
+    bool bufs_returned;           // Since the starved connections were last rearmed
+
+    struct uring_conn* conns;
+    struct uring_conn* starved;
+    size_t n_conns;
+};
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params* p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// Every opcode this mode submits (multishot recv is tried out separately, see probe_recv_multishot())
+
+static bool uring_probe(int fd) {
+    static const int needed[] = {IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_ASYNC_CANCEL};
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = calloc(1, size);
+
+    if (!probe) return false;
+
+    bool ok = sys_io_uring_register(fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+
+    for (size_t i = 0; ok && i < sizeof(needed) / sizeof(needed[0]); ++i)
+        ok = needed[i] <= probe->last_op && (probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED);
+
+    free(probe);
+    return ok;
+}
+
+static void uring_free(struct uring* u) {
+    if (u->fd >= 0) close(u->fd);
+    if (u->ring_mem) munmap(u->ring_mem, u->ring_size);
+    if (u->sqes) munmap(u->sqes, u->sqes_size);
+    if (u->br) munmap(u->br, URING_BUFS * sizeof(struct io_uring_buf));
+    if (u->bufs) munmap(u->bufs, (size_t)URING_BUFS * URING_BUF_SIZE);
+    free(u);
+}
+
+// Returns NULL with errno set when this kernel cannot run the mode
+
+static struct uring* uring_create() {
+    struct uring* u = calloc(1, sizeof(struct uring));
+
+    if (!u) return NULL;
+
+    struct io_uring_params p;
+
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+    p.cq_entries = 4 * URING_ENTRIES;
+
+    u->fd = sys_io_uring_setup(URING_ENTRIES, &p);
+
+    // Off by default in some containers (io_uring_disabled, seccomp): ENOSYS or EPERM
+    if (u->fd < 0) goto fail;
+
+    // One mapping for both queues (5.4), and no completion is ever dropped (5.5)
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP) || !uring_probe(u->fd)) {
+        errno = EOPNOTSUPP;
+        goto fail;
+    }
+
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+    u->ring_size = sq_size > cq_size ? sq_size : cq_size;
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    char* ring = mmap(NULL, u->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+
+    if (ring == MAP_FAILED) goto fail;
+
+    u->ring_mem = ring;
+
+    u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+
+    if (u->sqes == MAP_FAILED) {
+        u->sqes = NULL;
+        goto fail;
+    }
+
+    u->sq_head = (_Atomic unsigned*)(ring + p.sq_off.head);
+    u->sq_tail = (_Atomic unsigned*)(ring + p.sq_off.tail);
+    u->sq_mask = *(unsigned*)(ring + p.sq_off.ring_mask);
+    u->sq_local_tail = atomic_load_explicit(u->sq_tail, memory_order_relaxed);
+
+    // Slot i of the submission queue always holds SQE i
+    unsigned* array = (unsigned*)(ring + p.sq_off.array);
+
+    for (unsigned i = 0; i < p.sq_entries; ++i) array[i] = i;
+
+    u->cq_head = (_Atomic unsigned*)(ring + p.cq_off.head);
+    u->cq_tail = (_Atomic unsigned*)(ring + p.cq_off.tail);
+    u->cq_mask = *(unsigned*)(ring + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe*)(ring + p.cq_off.cqes);
+
+    // The buffers are only touched once received into, so unused ones cost no memory
+    u->br = mmap(NULL, URING_BUFS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    u->bufs = mmap(NULL, (size_t)URING_BUFS * URING_BUF_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (u->br == MAP_FAILED || u->bufs == MAP_FAILED) {
+        if (u->br == MAP_FAILED) u->br = NULL;
+        if (u->bufs == MAP_FAILED) u->bufs = NULL;
+        goto fail;
+    }
+
+    struct io_uring_buf_reg reg;
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)u->br;
+    reg.ring_entries = URING_BUFS;
+    reg.bgid = URING_BGID;
+
+    // Provided buffer rings arrived in 5.19
+    if (sys_io_uring_register(u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) goto fail;
+
+    u->br_tail = (_Atomic uint16_t*)&u->br->tail;
+
+    for (int bid = 0; bid < URING_BUFS; ++bid) {
+        struct io_uring_buf* b = &u->br->bufs[bid];
+
+        b->addr = (uint64_t)(uintptr_t)(u->bufs + (size_t)bid * URING_BUF_SIZE);
+        b->len = URING_BUF_SIZE;
+        b->bid = (uint16_t)bid;
+    }
+
+    u->br_local_tail = URING_BUFS;
+    atomic_store_explicit(u->br_tail, u->br_local_tail, memory_order_release);
+
+    return u;
+
+fail:;
+    int saved = errno;
+
+    uring_free(u);
+    errno = saved;
+    return NULL;
+}
+
+// Publish the queued entries and hand them to the kernel; wait: block for one completion
+
+static int uring_submit(struct uring* u, bool wait) {
+    atomic_store_explicit(u->sq_tail, u->sq_local_tail, memory_order_release);
+
+    unsigned to_submit = u->sq_local_tail - atomic_load_explicit(u->sq_head, memory_order_acquire);
+
+    if (to_submit == 0 && !wait) return 0;
+
+    return sys_io_uring_enter(u->fd, to_submit, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0);
+}
+
+// Make n submission queue slots free, submitting what is queued if needed
+
+static bool uring_reserve(struct uring* u, unsigned n) {
+    // The kernel copies an SQE out as it takes it, so the slot is free again right away
+    while (u->sq_mask + 1 - (u->sq_local_tail - atomic_load_explicit(u->sq_head, memory_order_acquire)) < n) {
+        if (uring_submit(u, false) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            perror("io_uring_enter");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static struct io_uring_sqe* uring_sqe(struct uring* u) {
+    if (!uring_reserve(u, 1)) return NULL;
+
+    struct io_uring_sqe* sqe = &u->sqes[u->sq_local_tail & u->sq_mask];
+
+    memset(sqe, 0, sizeof(*sqe));
+    u->sq_local_tail++;
+
+    return sqe;
+}
+
+static uint64_t conn_data(struct uring_conn* c, enum uring_op op) {
+    return (uint64_t)(uintptr_t)c | op;
+}
+
+static void arm_accept(struct uring* u) {
+    struct io_uring_sqe* sqe = uring_sqe(u);
+
+    if (!sqe) return;
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = u->lfd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = OP_ACCEPT;
+
+    u->accept_armed = true;
+}
+
+static void arm_recv(struct uring* u, struct uring_conn* c) {
+    struct io_uring_sqe* sqe = uring_sqe(u);
+
+    if (!sqe) return;
+
+    // No buffer of our own: the kernel takes one from the group for each chunk
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = c->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    sqe->user_data = conn_data(c, OP_RECV);
+
+    c->recv_armed = true;
+    c->inflight++;
+}
+
+static void cancel_recv(struct uring* u, struct uring_conn* c) {
+    struct io_uring_sqe* sqe = uring_sqe(u);
+
+    if (!sqe) return;
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = conn_data(c, OP_RECV);
+    sqe->user_data = conn_data(c, OP_CANCEL);
+
+    c->inflight++;
+}
+
+static void return_buf(struct uring* u, int bid) {
+    struct io_uring_buf* b = &u->br->bufs[u->br_local_tail & (URING_BUFS - 1)];
+
+    b->addr = (uint64_t)(uintptr_t)(u->bufs + (size_t)bid * URING_BUF_SIZE);
+    b->len = URING_BUF_SIZE;
+    b->bid = (uint16_t)bid;
+
+    u->br_local_tail++;
+    atomic_store_explicit(u->br_tail, u->br_local_tail, memory_order_release);
+
+    u->bufs_returned = true;
+}
+
+/* Multishot recv (6.0) has no bit in the probe, and older kernels reject the
+flag with EINVAL, so run one on a socket pair: one byte and then end of
+input complete it twice on a kernel that has it */
+
+static bool probe_recv_multishot(struct uring* u) {
+    int sv[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) return false;
+
+    struct io_uring_sqe* sqe = NULL;
+
+    if (write(sv[1], "x", 1) == 1 && shutdown(sv[1], SHUT_WR) == 0) sqe = uring_sqe(u);
+
+    if (sqe) {
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = sv[0];
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = URING_BGID;
+        sqe->user_data = OP_RECV;
+    }
+
+    bool ok = sqe != NULL;
+    bool done = !ok;
+
+    while (!done) {
+        if (uring_submit(u, true) < 0) {
+            if (errno == EINTR) continue;
+            ok = false;
+            break;
+        }
+
+        unsigned head = atomic_load_explicit(u->cq_head, memory_order_relaxed);
+        unsigned tail = atomic_load_explicit(u->cq_tail, memory_order_acquire);
+
+        for (; head != tail; ++head) {
+            struct io_uring_cqe cqe = u->cqes[head & u->cq_mask];
+
+            atomic_store_explicit(u->cq_head, head + 1, memory_order_release);
+
+            if (cqe.flags & IORING_CQE_F_BUFFER) return_buf(u, (int)(cqe.flags >> IORING_CQE_BUFFER_SHIFT));
+
+            if (cqe.res < 0) ok = false;
+            if (!(cqe.flags & IORING_CQE_F_MORE)) done = true;
+        }
+    }
+
+    close(sv[0]);
+    close(sv[1]);
+
+    return ok;
+}
+
+// Send the queued buffers as one linked chain, unless a chain is still in flight
+
+static void send_queued(struct uring* u, struct uring_conn* c) {
+    if (c->sending > 0 || c->closing || c->head < 0) return;
+
+    // A chain split over two submissions would lose its ordering, so it goes in whole
+    if (!uring_reserve(u, URING_MAX_CHAIN)) return;
+
+    for (int bid = c->head; bid >= 0 && c->sending < URING_MAX_CHAIN; bid = u->meta[bid].next) {
+        struct io_uring_sqe* sqe = uring_sqe(u);
+
+        // MSG_WAITALL: the kernel retries a short send itself instead of breaking the chain
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = c->fd;
+        sqe->addr = (uint64_t)(uintptr_t)(u->bufs + (size_t)bid * URING_BUF_SIZE + u->meta[bid].off);
+        sqe->len = u->meta[bid].len - u->meta[bid].off;
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+        sqe->user_data = conn_data(c, OP_SEND);
+
+        // Linked: starts only once the one before it has completed in full
+        if (u->meta[bid].next >= 0 && c->sending + 1 < URING_MAX_CHAIN) sqe->flags = IOSQE_IO_LINK;
+
+        c->sending++;
+        c->inflight++;
+    }
+}
+
+static void close_uring_conn(struct uring* u, struct uring_conn* c) {
+    if (c->closing) return;
+
+    c->closing = true;
+
+    fprintf(stderr, "[uring] Disconnected (%zu open)\n", u->n_conns - 1);
+
+    // Ends the recv and fails the sends, so every request still out completes soon
+    shutdown(c->fd, SHUT_RDWR);
+}
+
+// Frees the connection once it is closing and the kernel holds nothing of it
+
+static void settle(struct uring* u, struct uring_conn* c) {
+    if (!c->closing || c->inflight > 0) return;
+
+    for (int bid = c->head; bid >= 0; bid = u->meta[bid].next) return_buf(u, bid);
+
+    if (c->starved) {
+        struct uring_conn** p = &u->starved;
+
+        while (*p != c) p = &(*p)->next_starved;
+
+        *p = c->next_starved;
+    }
+
+    if (c->prev) c->prev->next = c->next;
+    else u->conns = c->next;
+
+    if (c->next) c->next->prev = c->prev;
+
+    u->n_conns--;
+
+    close(c->fd);
+    free(c);
+
+    // A descriptor is free again, so a stalled accept can take the next connection
+    u->accept_stalled = false;
+}
+
+static void on_accept(struct uring* u, struct io_uring_cqe* cqe) {
+    if (!(cqe->flags & IORING_CQE_F_MORE)) u->accept_armed = false;
+
+    if (cqe->res < 0) {
+        if (cqe->res == -ECONNABORTED || cqe->res == -EINTR) return;
+
+        // EMFILE and friends would fail again at once, so accepting waits for a connection to close
+        if (!(cqe->flags & IORING_CQE_F_MORE)) u->accept_stalled = true;
+
+        if (u->accept_error != -cqe->res) fprintf(stderr, "accept: %s\n", strerror(-cqe->res));
+
+        u->accept_error = -cqe->res;
+        return;
+    }
+
+    u->accept_error = 0;
+
+    struct uring_conn* c = calloc(1, sizeof(struct uring_conn));
+
+    if (!c) {
+        perror("calloc");
+        close(cqe->res);
+        return;
+    }
+
+    c->fd = cqe->res;
+    c->head = c->tail = -1;
+
+    c->next = u->conns;
+    if (u->conns) u->conns->prev = c;
+    u->conns = c;
+    u->n_conns++;
+
+    char host[NI_MAXHOST], serv[NI_MAXSERV];
+
+    if (peer_name(c->fd, host, sizeof(host), serv, sizeof(serv)))
+        fprintf(stderr, "[uring] Connected: %s %s (%zu open)\n", host, serv, u->n_conns);
+
+    arm_recv(u, c);
+}
+
+static void on_recv(struct uring* u, struct uring_conn* c, struct io_uring_cqe* cqe) {
+    bool more = cqe->flags & IORING_CQE_F_MORE;
+
+    if (!more) {
+        c->recv_armed = false;
+        c->inflight--;
+    }
+
+    if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+        int bid = (int)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+
+        u->meta[bid].next = -1;
+        u->meta[bid].len = (unsigned)cqe->res;
+        u->meta[bid].off = 0;
+
+        if (c->closing) return_buf(u, bid);
+
+        else {
+            if (c->tail >= 0) u->meta[c->tail].next = bid;
+            else c->head = bid;
+
+            c->tail = bid;
+            c->queued += (size_t)cqe->res;
+
+            send_queued(u, c);
+
+            // A client that sends without reading gets no more than MAX_PENDING of the buffers
+            if (c->queued >= MAX_PENDING && !c->read_paused) {
+                c->read_paused = true;
+                if (c->recv_armed) cancel_recv(u, c);
+            }
+        }
+    }
+
+    else if (cqe->res == 0) c->peer_closed = true;
+
+    else if (cqe->res == -ENOBUFS) {
+        // Every buffer is queued for sending; rearmed once one comes back
+        if (!c->starved && !c->closing) {
+            c->starved = true;
+            c->next_starved = u->starved;
+            u->starved = c;
+        }
+    }
+
+    else if (cqe->res < 0 && cqe->res != -ECANCELED) {
+        if (cqe->res != -ECONNRESET) fprintf(stderr, "recv: %s\n", strerror(-cqe->res));
+        close_uring_conn(u, c);
+    }
+
+    if (c->closing || more || c->recv_armed) return;
+
+    // Client finished sending; whatever it sent last still goes back first
+    if (c->peer_closed) {
+        if (c->head < 0) close_uring_conn(u, c);
+    }
+
+    else if (!c->read_paused && !c->starved) arm_recv(u, c);
+}
+
+static void on_send(struct uring* u, struct uring_conn* c, struct io_uring_cqe* cqe) {
+    c->sending--;
+    c->inflight--;
+
+    // Links complete in order, so this is the send of the buffer at the head
+    if (cqe->res >= 0 && c->head >= 0) {
+        int bid = c->head;
+
+        u->meta[bid].off += (unsigned)cqe->res;
+        c->queued -= (size_t)cqe->res;
+
+        // Short: the rest of the chain is cancelled, and the next chain resends the remainder
+        if (u->meta[bid].off == u->meta[bid].len) {
+            c->head = u->meta[bid].next;
+            if (c->head < 0) c->tail = -1;
+
+            return_buf(u, bid);
+        }
+    }
+
+    else if (cqe->res < 0 && cqe->res != -ECANCELED) {
+        if (cqe->res != -ECONNRESET && cqe->res != -EPIPE) fprintf(stderr, "send: %s\n", strerror(-cqe->res));
+        c->failed = true;
+    }
+
+    if (c->sending > 0 || c->closing) return;
+
+    if (c->failed || (c->peer_closed && c->head < 0 && !c->recv_armed)) {
+        close_uring_conn(u, c);
+        return;
+    }
+
+    send_queued(u, c);
+
+    if (c->read_paused && c->queued < MAX_PENDING) {
+        c->read_paused = false;
+        if (!c->recv_armed && !c->peer_closed) arm_recv(u, c);
+    }
+}
+
+static void on_completion(struct uring* u, struct io_uring_cqe* cqe) {
+    enum uring_op op = (enum uring_op)(cqe->user_data & 7);
+    struct uring_conn* c = (struct uring_conn*)(uintptr_t)(cqe->user_data & ~(uint64_t)7);
+
+    switch (op) {
+    case OP_ACCEPT:
+        on_accept(u, cqe);
+        return;
+
+    case OP_RECV:
+        on_recv(u, c, cqe);
+        break;
+
+    case OP_SEND:
+        on_send(u, c, cqe);
+        break;
+
+    case OP_CANCEL:
+        c->inflight--; // The recv reports -ECANCELED on its own
+        break;
+    }
+
+    settle(u, c);
+}
+
+static int uring_run(struct uring* u) {
+    arm_accept(u);
+
+    while (keep_running) {
+        // Submits everything queued by the last batch and sleeps until the next completion
+        if (uring_submit(u, true) < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue; // keep_running is checked again
+            perror("io_uring_enter");
+            break;
+        }
+
+        unsigned head = atomic_load_explicit(u->cq_head, memory_order_relaxed);
+        unsigned tail = atomic_load_explicit(u->cq_tail, memory_order_acquire);
+
+        for (; head != tail; ++head) {
+            // Copied out first: the slot is the kernel's again once head moves past it
+            struct io_uring_cqe cqe = u->cqes[head & u->cq_mask];
+
+            atomic_store_explicit(u->cq_head, head + 1, memory_order_release);
+            on_completion(u, &cqe);
+        }
+
+        if (u->bufs_returned) {
+            u->bufs_returned = false;
+
+            while (u->starved) {
+                struct uring_conn* c = u->starved;
+
+                u->starved = c->next_starved;
+                c->starved = false;
+
+                if (!c->closing && !c->read_paused && !c->recv_armed && !c->peer_closed) arm_recv(u, c);
+            }
+        }
+
+        if (!u->accept_armed && !u->accept_stalled) arm_accept(u);
+    }
+
+    // Closing the ring cancels every request, after which the connections can go
+    close(u->fd);
+    u->fd = -1;
+
+    while (u->conns) {
+        struct uring_conn* c = u->conns;
+
+        u->conns = c->next;
+        close(c->fd);
+        free(c);
+    }
+
+    return 0;
+}
+
+int tcp_server_uring(const char* port) {
+    struct uring* u = uring_create();
+
+    if (u && !probe_recv_multishot(u)) {
+        uring_free(u);
+        u = NULL;
+        errno = EOPNOTSUPP;
+    }
+
+    if (!u) {
+        fprintf(stderr, "[*] io_uring unavailable (%s), using epoll\n", strerror(errno));
+        return tcp_server_epoll(port);
+    }
+
+    int lfd = make_listener(port, false);
+
+    if (lfd < 0) {
+        uring_free(u);
+        return EXIT_FAILURE;
+    }
+
+    raise_fd_limit();
+
+    u->lfd = lfd;
+
+    fprintf(stderr, "[*] Listening on port %s (io_uring, %d buffers of %d bytes)\n", port, URING_BUFS, URING_BUF_SIZE);
+
+    int rc = uring_run(u);
+
+    uring_free(u);
+    close(lfd);
+
+    fprintf(stderr, "[*] Server shut down.\n");
+    return rc < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [--mode=fork|epoll|reactors|prefork|uring] [--threads=N] [--workers=N] [--max-conns=N] [port]\n", prog);
+}
+
+int main(int argc, char* argv[]) {
+    const char* port = "8080";
+    const char* mode = "fork";
+    int n_threads = 0; // reactors: one per CPU
+    int n_workers = 0; // prefork: one per CPU
+    int max_conns = 1000; // prefork: connections a worker serves before it is replaced
+
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--mode=", 7) == 0) mode = argv[i] + 7;
+
+        else if (strncmp(argv[i], "--threads=", 10) == 0) n_threads = atoi(argv[i] + 10);
+
+        else if (strncmp(argv[i], "--workers=", 10) == 0) n_workers = atoi(argv[i] + 10);
+
+        else if (strncmp(argv[i], "--max-conns=", 12) == 0) max_conns = atoi(argv[i] + 12);
+
+        else if (argv[i][0] == '-') {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        else port = argv[i];
+    }
+
+    install_signals();
+
+    if (strcmp(mode, "fork") == 0) return tcp_server_fork(port);
+
+    if (strcmp(mode, "epoll") == 0) return tcp_server_epoll(port);
+
+    if (strcmp(mode, "reactors") == 0) return tcp_server_reactors(port, n_threads);
+
+    if (strcmp(mode, "prefork") == 0) return tcp_server_prefork(port, n_workers, max_conns);
+
+    if (strcmp(mode, "uring") == 0) return tcp_server_uring(port);
 
-    return tcp_server_fork(port);
+    usage(argv[0]);
+    return EXIT_FAILURE;
 }
\ No newline at end of file